@@ -0,0 +1,403 @@
+#include "demand_model.h"
+#include <QFile>
+#include <QTextStream>
+#include <QDebug>
+#include <limits>
+#include <cmath>
+#include <algorithm>
+
+double unitRandom(std::mt19937& rng)
+{
+    // 53 random bits, as in std::generate_canonical but fully specified
+    quint64 high = rng() >> 5;
+    quint64 low = rng() >> 6;
+    return double(high * 67108864 + low) / 9007199254740992.0;
+}
+
+quint32 boundedRandom(std::mt19937& rng, quint32 bound)
+{
+    return quint32((quint64(rng()) * bound) >> 32);
+}
+
+// ----------------------------------------------------------------------
+// AliasTable
+// ----------------------------------------------------------------------
+
+void AliasTable::build(const QVector<double>& weights)
+{
+    int n = weights.size();
+    probability.fill(0.0, n);
+    alias.fill(0, n);
+
+    double total = 0.0;
+    for (double w : weights) {
+        total += qMax(0.0, w);
+    }
+    if (n == 0 || total <= 0.0) {
+        probability.clear();
+        alias.clear();
+        return;
+    }
+
+    // Scale so the average column holds exactly 1
+    QVector<double> scaled(n);
+    QVector<int> small, large;
+    for (int i = 0; i < n; ++i) {
+        scaled[i] = qMax(0.0, weights[i]) * n / total;
+        (scaled[i] < 1.0 ? small : large).append(i);
+    }
+
+    // Each short column is topped up by one tall column
+    while (!small.isEmpty() && !large.isEmpty()) {
+        int s = small.takeLast();
+        int l = large.last();
+        probability[s] = scaled[s];
+        alias[s] = l;
+
+        scaled[l] -= 1.0 - scaled[s];
+        if (scaled[l] < 1.0) {
+            large.removeLast();
+            small.append(l);
+        }
+    }
+
+    // Leftovers are full columns up to rounding error
+    for (int i : large) {
+        probability[i] = 1.0;
+    }
+    for (int i : small) {
+        probability[i] = 1.0;
+    }
+}
+
+int AliasTable::sample(std::mt19937& rng) const
+{
+    int column = int(boundedRandom(rng, quint32(probability.size())));
+    return unitRandom(rng) < probability[column] ? column : alias[column];
+}
+
+// ----------------------------------------------------------------------
+// DemandModel
+// ----------------------------------------------------------------------
+
+DemandModel::DemandModel(const Graph* g, quint32 seed)
+    : graph(g),
+    seed(seed),
+    rng(seed),
+    explicitZones(false),
+    generatedUntil(0.0)
+{
+    routableNodes = graph->largestComponent();
+    routable = QSet<qint64>(routableNodes.cbegin(), routableNodes.cend());
+}
+
+void DemandModel::clear()
+{
+    zones.clear();
+    zoneIndex.clear();
+    explicitZones = false;
+    windows.clear();
+    pending.clear();
+    generatedUntil = 0.0;
+}
+
+void DemandModel::rewind()
+{
+    rng.seed(seed);
+    pending.clear();
+    generatedUntil = 0.0;
+}
+
+DemandModel::State DemandModel::capture() const
+{
+    State state;
+    state.rng = rng;
+    state.generatedUntil = generatedUntil;
+    state.pending = pending;
+    return state;
+}
+
+void DemandModel::restore(const State& state)
+{
+    rng = state.rng;
+    generatedUntil = state.generatedUntil;
+    pending = state.pending;
+}
+
+// Zone index for a trip table name. Without a zones file, node ids become
+// single-node zones and are added to zoneList / index.
+int DemandModel::zoneFor(const QString& name, QVector<Zone>& zoneList,
+                         QHash<QString, int>& index) const
+{
+    auto it = index.constFind(name);
+    if (it != index.constEnd()) {
+        return it.value();
+    }
+    if (explicitZones) {
+        return -1;
+    }
+
+    // Without a zones file every node id is its own zone
+    bool ok = false;
+    qint64 nodeId = name.toLongLong(&ok);
+    if (!ok || !routable.contains(nodeId)) {
+        return -1;
+    }
+
+    Zone zone;
+    zone.nodes.append(nodeId);
+    zone.weights.append(1.0);
+    zone.table.build(zone.weights);
+    zoneList.append(zone);
+    index.insert(name, zoneList.size() - 1);
+    return zoneList.size() - 1;
+}
+
+namespace {
+
+// Calls row(fields, lineNumber) for every data line; blank lines, '#'
+// comments and a header row (the first row, if `numericColumn` is not
+// numeric there) are skipped
+template <typename Row>
+bool readCsv(const QString& filePath, int numericColumn, Row row)
+{
+    QFile file(filePath);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        qWarning() << "Cannot open demand file" << filePath;
+        return false;
+    }
+
+    QTextStream in(&file);
+    int lineNumber = 0;
+    bool firstRow = true;
+    while (!in.atEnd()) {
+        const QString line = in.readLine();
+        lineNumber++;
+
+        QStringView trimmed = QStringView(line).trimmed();
+        if (trimmed.isEmpty() || trimmed.startsWith(u'#')) {
+            continue;
+        }
+
+        const QStringList fields = line.split(',');
+        bool numeric = false;
+        fields.value(numericColumn).trimmed().toDouble(&numeric);
+        if (!numeric && firstRow) {
+            firstRow = false;
+            continue;
+        }
+        firstRow = false;
+        if (!row(fields, lineNumber)) {
+            qWarning() << "Bad row in" << filePath << "line" << lineNumber << ":" << line;
+            return false;
+        }
+    }
+    return true;
+}
+
+}
+
+bool DemandModel::loadZones(const QString& filePath)
+{
+    QHash<QString, int> loaded;
+    QVector<Zone> loadedZones;
+
+    bool ok = readCsv(filePath, 1, [&](const QStringList& fields, int) {
+        if (fields.size() < 2) {
+            return false;
+        }
+        bool idOk = false, weightOk = true;
+        QString name = fields[0].trimmed();
+        qint64 nodeId = fields[1].trimmed().toLongLong(&idOk);
+        double weight = fields.size() > 2 ? fields[2].trimmed().toDouble(&weightOk) : 1.0;
+        if (!idOk || !weightOk || name.isEmpty()) {
+            return false;
+        }
+
+        // Nodes outside the largest component could strand their trips
+        if (!routable.contains(nodeId)) {
+            return true;
+        }
+
+        int index = loaded.value(name, -1);
+        if (index < 0) {
+            index = loadedZones.size();
+            loaded.insert(name, index);
+            loadedZones.append(Zone());
+        }
+        loadedZones[index].nodes.append(nodeId);
+        loadedZones[index].weights.append(weight);
+        return true;
+    });
+    if (!ok) {
+        return false;
+    }
+
+    clear();
+    zones = loadedZones;
+    zoneIndex = loaded;
+    explicitZones = true;
+    for (Zone& zone : zones) {
+        zone.table.build(zone.weights);
+    }
+    return true;
+}
+
+// Rows are staged into copies of the tables and only committed once the
+// whole file has parsed
+bool DemandModel::loadTrips(const QString& filePath)
+{
+    const double INF = std::numeric_limits<double>::infinity();
+    int skipped = 0;
+    QVector<Zone> stagedZones = zones;
+    QHash<QString, int> stagedIndex = zoneIndex;
+    QVector<Window> stagedWindows = windows;
+
+    bool ok = readCsv(filePath, 2, [&](const QStringList& fields, int) {
+        if (fields.size() != 3 && fields.size() != 5) {
+            return false;
+        }
+        bool tripsOk = false, startOk = true, endOk = true;
+        double trips = fields[2].trimmed().toDouble(&tripsOk);
+        double start = fields.size() == 5 ? fields[3].trimmed().toDouble(&startOk) : 0.0;
+        double end = fields.size() == 5 ? fields[4].trimmed().toDouble(&endOk) : INF;
+        if (!tripsOk || !startOk || !endOk || trips < 0.0 || end <= start) {
+            return false;
+        }
+
+        int origin = zoneFor(fields[0].trimmed(), stagedZones, stagedIndex);
+        int destination = zoneFor(fields[1].trimmed(), stagedZones, stagedIndex);
+        if (origin < 0 || destination < 0 || stagedZones[origin].table.isEmpty() ||
+            stagedZones[destination].table.isEmpty()) {
+            skipped++;
+            return true;
+        }
+
+        // Rows sharing a window are sampled from one alias table
+        int w = 0;
+        while (w < stagedWindows.size() &&
+               (stagedWindows[w].start != start || stagedWindows[w].end != end)) {
+            w++;
+        }
+        if (w == stagedWindows.size()) {
+            Window window;
+            window.start = start;
+            window.end = end;
+            window.rate = 0.0;
+            stagedWindows.append(window);
+        }
+        stagedWindows[w].pairs.append(qMakePair(origin, destination));
+        stagedWindows[w].trips.append(trips);
+        return true;
+    });
+    if (!ok) {
+        return false;
+    }
+
+    if (skipped > 0) {
+        qWarning() << "Skipped" << skipped << "trip rows with unknown or unroutable zones";
+    }
+
+    for (Window& window : stagedWindows) {
+        double total = 0.0;
+        for (double trips : window.trips) {
+            total += trips;
+        }
+        window.rate = std::isinf(window.end) ? total / 3600.0 : total / (window.end - window.start);
+        window.table.build(window.trips);
+    }
+
+    zones = stagedZones;
+    zoneIndex = stagedIndex;
+    windows = stagedWindows;
+    return true;
+}
+
+void DemandModel::setUniform(double tripsPerHour)
+{
+    clear();
+
+    Zone everywhere;
+    everywhere.nodes = routableNodes;   // dense order, the same in every process
+    everywhere.weights.fill(1.0, everywhere.nodes.size());
+    everywhere.table.build(everywhere.weights);
+    zones.append(everywhere);
+
+    Window window;
+    window.start = 0.0;
+    window.end = std::numeric_limits<double>::infinity();
+    window.rate = tripsPerHour / 3600.0;
+    window.pairs.append(qMakePair(0, 0));
+    window.trips.append(1.0);
+    window.table.build(window.trips);
+    windows.append(window);
+}
+
+void DemandModel::addDeparture(const Departure& departure)
+{
+    pending.append(departure);
+    std::push_heap(pending.begin(), pending.end(), LaterFirst());
+}
+
+double DemandModel::tripsPerHourAt(double time) const
+{
+    double rate = 0.0;
+    for (const Window& window : windows) {
+        if (time >= window.start && time < window.end) {
+            rate += window.rate;
+        }
+    }
+    return rate * 3600.0;
+}
+
+qint64 DemandModel::sampleNode(int zone)
+{
+    const Zone& z = zones[zone];
+    return z.nodes[z.table.sample(rng)];
+}
+
+// Extend every window's Poisson process up to `until`. The process is
+// memoryless, so restarting it at generatedUntil does not bias it.
+void DemandModel::generate(double until)
+{
+    for (const Window& window : windows) {
+        if (window.rate <= 0.0 || window.table.isEmpty()) {
+            continue;
+        }
+
+        double t = qMax(window.start, generatedUntil);
+        double stop = qMin(window.end, until);
+        for (;;) {
+            // Exponential inter-arrival time; 1 - u avoids log(0)
+            t += -std::log(1.0 - unitRandom(rng)) / window.rate;
+            if (t >= stop) {
+                break;
+            }
+
+            const QPair<int, int>& pair = window.pairs[window.table.sample(rng)];
+            Departure departure;
+            departure.time = t;
+            departure.origin = sampleNode(pair.first);
+            departure.destination = sampleNode(pair.second);
+            if (departure.origin != departure.destination) {
+                pending.append(departure);
+                std::push_heap(pending.begin(), pending.end(), LaterFirst());
+            }
+        }
+    }
+    generatedUntil = qMax(generatedUntil, until);
+}
+
+QVector<DemandModel::Departure> DemandModel::takeDue(double time)
+{
+    if (time + LOOKAHEAD_SECONDS > generatedUntil) {
+        generate(time + LOOKAHEAD_SECONDS);
+    }
+
+    QVector<Departure> due;
+    while (!pending.isEmpty() && pending.first().time <= time) {
+        std::pop_heap(pending.begin(), pending.end(), LaterFirst());
+        due.append(pending.takeLast());
+    }
+    return due;
+}
@@ -0,0 +1,123 @@
+#ifndef DEMAND_MODEL_H
+#define DEMAND_MODEL_H
+
+#include <QtGlobal>
+#include <QString>
+#include <QVector>
+#include <QHash>
+#include <QSet>
+#include <QPair>
+#include <random>
+#include "graph.h"
+
+// Draws from a std::mt19937 without the standard distributions, whose
+// output differs between standard libraries
+double unitRandom(std::mt19937& rng);                      // [0, 1)
+quint32 boundedRandom(std::mt19937& rng, quint32 bound);   // [0, bound)
+
+// Discrete distribution sampled in O(1) with Vose's alias method
+class AliasTable
+{
+public:
+    void build(const QVector<double>& weights);
+    int sample(std::mt19937& rng) const;
+    int size() const { return probability.size(); }
+    bool isEmpty() const { return probability.isEmpty(); }
+
+private:
+    QVector<double> probability;
+    QVector<int> alias;
+};
+
+// Origin-destination travel demand. Trips are read from CSV tables:
+//
+//   zones:  zone,node[,weight]              nodes a zone's trips start or end at
+//   trips:  origin,destination,trips[,start,end]
+//
+// A trip row with a window spreads `trips` departures over [start, end)
+// simulated seconds; without one it is a steady rate of `trips` per hour.
+// Origins and destinations name zones, or node ids when no zones file was
+// loaded. Only nodes in the graph's largest strongly connected component
+// are used, so every sampled trip is routable.
+//
+// Departures follow a Poisson process per window: OD pairs and zone nodes
+// are drawn from alias tables, and the resulting departures wait in a
+// binary heap until the simulation clock reaches them. Models with the
+// same seed produce the same departure stream.
+class DemandModel
+{
+public:
+    struct Departure {
+        double time;         // simulated seconds
+        qint64 origin;
+        qint64 destination;
+    };
+
+    // Clock and generator state, for simulator checkpoints. Capturing it
+    // copies the generator and shares the heap; the model is not changed.
+    struct State {
+        std::mt19937 rng;
+        double generatedUntil;
+        QVector<Departure> pending;    // heap order, restored as is
+    };
+
+    explicit DemandModel(const Graph* graph, quint32 seed = 1);
+
+    bool loadZones(const QString& filePath);
+    bool loadTrips(const QString& filePath);
+    void setUniform(double tripsPerHour);   // random pairs from the whole network
+    void addDeparture(const Departure& departure);
+    void clear();
+    void rewind();                          // back to time 0; tables are kept
+
+    State capture() const;
+    void restore(const State& state);
+
+    // All departures due at or before `time`, in departure order
+    QVector<Departure> takeDue(double time);
+
+    double tripsPerHourAt(double time) const;
+    int pendingCount() const { return int(pending.size()); }
+
+private:
+    struct Zone {
+        QVector<qint64> nodes;
+        QVector<double> weights;
+        AliasTable table;
+    };
+
+    struct Window {
+        double start;
+        double end;                        // +inf for steady rates
+        double rate;                       // departures per simulated second
+        QVector<QPair<int, int>> pairs;    // (origin zone, destination zone)
+        QVector<double> trips;
+        AliasTable table;
+    };
+
+    struct LaterFirst {
+        bool operator()(const Departure& a, const Departure& b) const { return a.time > b.time; }
+    };
+
+    // Departures are generated this far ahead of the clock
+    static constexpr double LOOKAHEAD_SECONDS = 30.0;
+
+    const Graph* graph;
+    quint32 seed;
+    std::mt19937 rng;
+    QVector<qint64> routableNodes;   // largest SCC
+    QSet<qint64> routable;
+    QVector<Zone> zones;
+    QHash<QString, int> zoneIndex;
+    bool explicitZones;
+    QVector<Window> windows;
+    QVector<Departure> pending;      // min-heap on time, via LaterFirst
+    double generatedUntil;
+
+    int zoneFor(const QString& name, QVector<Zone>& zoneList, QHash<QString, int>& index) const;
+    void finishZones();
+    void generate(double until);
+    qint64 sampleNode(int zone);
+};
+
+#endif // DEMAND_MODEL_H
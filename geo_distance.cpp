@@ -0,0 +1,374 @@
+#include "geo_distance.h"
+#include <cmath>
+#include <algorithm>
+#include <cstdint>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define GEO_DISTANCE_SSE2
+#include <emmintrin.h>
+#endif
+#if defined(__AVX2__) && (defined(__FMA__) || defined(_MSC_VER))
+#define GEO_DISTANCE_AVX2
+#include <immintrin.h>
+#endif
+
+namespace {
+
+const double PI = 3.14159265358979323846;
+const double DEG_TO_RAD = PI / 180.0;
+
+// Taylor coefficients. sin and cos are only evaluated on [-pi/2, pi/2] and
+// asin on [0, 0.5], where these truncations are accurate to ~1e-17.
+const double SIN_COEFFS[] = {
+    1.0,
+    -0.16666666666666666,
+    0.008333333333333333,
+    -0.0001984126984126984,
+    2.7557319223985893e-06,
+    -2.505210838544172e-08,
+    1.6059043836821613e-10,
+    -7.647163731819816e-13,
+    2.8114572543455206e-15,
+    -8.22063524662433e-18,
+    1.9572941063391263e-20
+};
+
+const double COS_COEFFS[] = {
+    1.0,
+    -0.5,
+    0.041666666666666664,
+    -0.001388888888888889,
+    2.48015873015873e-05,
+    -2.755731922398589e-07,
+    2.08767569878681e-09,
+    -1.1470745597729725e-11,
+    4.779477332387385e-14,
+    -1.5619206968586225e-16,
+    4.110317623312165e-19,
+    -8.896791392450574e-22
+};
+
+const double ASIN_COEFFS[] = {
+    1.0,
+    0.16666666666666666,
+    0.075,
+    0.044642857142857144,
+    0.030381944444444444,
+    0.022372159090909092,
+    0.017352764423076924,
+    0.01396484375,
+    0.011551800896139705,
+    0.009761609529194078,
+    0.008390335809616815,
+    0.0073125258735988454,
+    0.006447210311889649,
+    0.005740037670841924,
+    0.005153309682319905,
+    0.004660143486915096,
+    0.004240907093679363,
+    0.003880964558837669,
+    0.0035692053938259347,
+    0.003297059503473485,
+    0.0030578216492580306,
+    0.002846178401108942,
+    0.00265787063820729
+};
+
+// Lane types: the kernels below are written once against this interface
+// and instantiated per instruction set.
+struct ScalarLanes {
+    typedef double V;
+    typedef bool M;
+    static const int Width = 1;
+
+    static V load(const double* p) { return *p; }
+    static void store(double* p, V v) { *p = v; }
+    static V set(double x) { return x; }
+    static V add(V a, V b) { return a + b; }
+    static V sub(V a, V b) { return a - b; }
+    static V mul(V a, V b) { return a * b; }
+    static V fma(V a, V b, V c) { return a * b + c; }
+    static V sqrt(V a) { return std::sqrt(a); }
+    static V min(V a, V b) { return a < b ? a : b; }
+    static M less(V a, V b) { return a < b; }
+    static V select(M m, V a, V b) { return m ? a : b; }
+    static bool all(M m) { return m; }
+};
+
+#if defined(GEO_DISTANCE_SSE2)
+struct Sse2Lanes {
+    typedef __m128d V;
+    typedef __m128d M;
+    static const int Width = 2;
+
+    static V load(const double* p) { return _mm_loadu_pd(p); }
+    static void store(double* p, V v) { _mm_storeu_pd(p, v); }
+    static V set(double x) { return _mm_set1_pd(x); }
+    static V add(V a, V b) { return _mm_add_pd(a, b); }
+    static V sub(V a, V b) { return _mm_sub_pd(a, b); }
+    static V mul(V a, V b) { return _mm_mul_pd(a, b); }
+    static V fma(V a, V b, V c) { return _mm_add_pd(_mm_mul_pd(a, b), c); }
+    static V sqrt(V a) { return _mm_sqrt_pd(a); }
+    static V min(V a, V b) { return _mm_min_pd(a, b); }
+    static M less(V a, V b) { return _mm_cmplt_pd(a, b); }
+    static V select(M m, V a, V b) { return _mm_or_pd(_mm_and_pd(m, a), _mm_andnot_pd(m, b)); }
+    static bool all(M m) { return _mm_movemask_pd(m) == 0x3; }
+};
+#endif
+
+#if defined(GEO_DISTANCE_AVX2)
+struct Avx2Lanes {
+    typedef __m256d V;
+    typedef __m256d M;
+    static const int Width = 4;
+
+    static V load(const double* p) { return _mm256_loadu_pd(p); }
+    static void store(double* p, V v) { _mm256_storeu_pd(p, v); }
+    static V set(double x) { return _mm256_set1_pd(x); }
+    static V add(V a, V b) { return _mm256_add_pd(a, b); }
+    static V sub(V a, V b) { return _mm256_sub_pd(a, b); }
+    static V mul(V a, V b) { return _mm256_mul_pd(a, b); }
+    static V fma(V a, V b, V c) { return _mm256_fmadd_pd(a, b, c); }
+    static V sqrt(V a) { return _mm256_sqrt_pd(a); }
+    static V min(V a, V b) { return _mm256_min_pd(a, b); }
+    static M less(V a, V b) { return _mm256_cmp_pd(a, b, _CMP_LT_OQ); }
+    static V select(M m, V a, V b) { return _mm256_blendv_pd(b, a, m); }
+    static bool all(M m) { return _mm256_movemask_pd(m) == 0xf; }
+};
+#endif
+
+#if defined(GEO_DISTANCE_AVX2)
+typedef Avx2Lanes BestLanes;
+#elif defined(GEO_DISTANCE_SSE2)
+typedef Sse2Lanes BestLanes;
+#else
+typedef ScalarLanes BestLanes;
+#endif
+
+// Horner evaluation of sum(coeffs[i] * x2^i)
+template <typename L, int N>
+inline typename L::V polynomial(const double (&coeffs)[N], typename L::V x2)
+{
+    typename L::V p = L::set(coeffs[N - 1]);
+    for (int i = N - 2; i >= 0; --i)
+        p = L::fma(p, x2, L::set(coeffs[i]));
+    return p;
+}
+
+// |x| <= pi/2
+template <typename L>
+inline typename L::V sinPoly(typename L::V x)
+{
+    return L::mul(polynomial<L>(SIN_COEFFS, L::mul(x, x)), x);
+}
+
+template <typename L>
+inline typename L::V cosPoly(typename L::V x)
+{
+    return polynomial<L>(COS_COEFFS, L::mul(x, x));
+}
+
+// 0 <= x <= 1. Above 0.5 uses asin(x) = pi/2 - 2 asin(sqrt((1 - x) / 2)),
+// so the series only ever sees arguments up to 0.5.
+template <typename L>
+inline typename L::V asinPoly(typename L::V x)
+{
+    typename L::M small = L::less(x, L::set(0.5));
+    typename L::V y = L::select(small, x, L::sqrt(L::mul(L::sub(L::set(1.0), x), L::set(0.5))));
+    typename L::V r = L::mul(polynomial<L>(ASIN_COEFFS, L::mul(y, y)), y);
+    return L::select(small, r, L::fma(r, L::set(-2.0), L::set(PI / 2.0)));
+}
+
+// Longitude difference folded into [-180, 180] degrees
+template <typename L>
+inline typename L::V wrapLongitude(typename L::V dLon)
+{
+    dLon = L::select(L::less(L::set(180.0), dLon), L::sub(dLon, L::set(360.0)), dLon);
+    return L::select(L::less(dLon, L::set(-180.0)), L::add(dLon, L::set(360.0)), dLon);
+}
+
+template <typename L>
+inline typename L::V haversineLanes(typename L::V lat1, typename L::V lon1,
+                                    typename L::V lat2, typename L::V lon2)
+{
+    const typename L::V toRad = L::set(DEG_TO_RAD);
+    const typename L::V halfToRad = L::set(DEG_TO_RAD / 2.0);
+
+    typename L::V sinHalfLat = sinPoly<L>(L::mul(L::sub(lat2, lat1), halfToRad));
+    typename L::V sinHalfLon = sinPoly<L>(L::mul(wrapLongitude<L>(L::sub(lon2, lon1)), halfToRad));
+    typename L::V cosLat = L::mul(cosPoly<L>(L::mul(lat1, toRad)), cosPoly<L>(L::mul(lat2, toRad)));
+
+    typename L::V a = L::fma(L::mul(cosLat, sinHalfLon), sinHalfLon,
+                             L::mul(sinHalfLat, sinHalfLat));
+    a = L::min(a, L::set(1.0));
+    return L::mul(asinPoly<L>(L::sqrt(a)), L::set(2.0 * GeoDistance::EARTH_RADIUS_KM));
+}
+
+template <typename L>
+inline typename L::V equirectangularLanes(typename L::V lat1, typename L::V lon1,
+                                          typename L::V lat2, typename L::V lon2)
+{
+    const typename L::V toRad = L::set(DEG_TO_RAD);
+
+    typename L::V meanLat = L::mul(L::add(lat1, lat2), L::set(DEG_TO_RAD / 2.0));
+    typename L::V x = L::mul(L::mul(wrapLongitude<L>(L::sub(lon2, lon1)), toRad), cosPoly<L>(meanLat));
+    typename L::V y = L::mul(L::sub(lat2, lat1), toRad);
+    return L::mul(L::sqrt(L::fma(x, x, L::mul(y, y))), L::set(GeoDistance::EARTH_RADIUS_KM));
+}
+
+// Distance for each lane; Fast uses the equirectangular estimate where it
+// is below FAST_MAX_KM. Lanes never influence each other's result.
+template <typename L>
+inline typename L::V distanceLanes(typename L::V a1, typename L::V o1,
+                                   typename L::V a2, typename L::V o2, bool fast)
+{
+    if (!fast)
+        return haversineLanes<L>(a1, o1, a2, o2);
+
+    // Road segments are nearly always short, so the haversine is usually
+    // skipped for the whole group
+    typename L::V estimate = equirectangularLanes<L>(a1, o1, a2, o2);
+    typename L::M shortPair = L::less(estimate, L::set(GeoDistance::FAST_MAX_KM));
+    if (L::all(shortPair))
+        return estimate;
+    return L::select(shortPair, estimate, haversineLanes<L>(a1, o1, a2, o2));
+}
+
+// One pair, broadcast to every lane, so single pairs and batch tails run
+// exactly the arithmetic a full group would
+template <typename L>
+inline double distanceOne(double lat1, double lon1, double lat2, double lon2, bool fast)
+{
+    double lanes[L::Width];
+    L::store(lanes, distanceLanes<L>(L::set(lat1), L::set(lon1), L::set(lat2), L::set(lon2), fast));
+    return lanes[0];
+}
+
+template <typename L>
+void batchLanes(const double* lat1, const double* lon1, const double* lat2, const double* lon2,
+                double* out, int count, bool fast)
+{
+    int i = 0;
+    for (; i + L::Width <= count; i += L::Width) {
+        L::store(out + i, distanceLanes<L>(L::load(lat1 + i), L::load(lon1 + i),
+                                           L::load(lat2 + i), L::load(lon2 + i), fast));
+    }
+    for (; i < count; ++i)
+        out[i] = distanceOne<L>(lat1[i], lon1[i], lat2[i], lon2[i], fast);
+}
+
+// Worst relative error of one lane type against GeoDistance::haversine()
+// over a fixed pseudo-random sample; see the header for the bounds
+template <typename L>
+bool withinBounds()
+{
+    const int SAMPLES = 1024;
+    uint64_t state = 0x9e3779b97f4a7c15ULL;
+    auto uniform = [&state](double lo, double hi) {
+        state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+        return lo + (hi - lo) * double(state >> 11) / 9007199254740992.0;
+    };
+
+    double lat1[SAMPLES], lon1[SAMPLES], lat2[SAMPLES], lon2[SAMPLES], out[SAMPLES];
+
+    // Haversine anywhere on the globe
+    for (int i = 0; i < SAMPLES; ++i) {
+        lat1[i] = uniform(-89.0, 89.0);
+        lon1[i] = uniform(-180.0, 180.0);
+        lat2[i] = uniform(-89.0, 89.0);
+        lon2[i] = uniform(-180.0, 180.0);
+    }
+    batchLanes<L>(lat1, lon1, lat2, lon2, out, SAMPLES, false);
+    for (int i = 0; i < SAMPLES; ++i) {
+        double exact = GeoDistance::haversine(lat1[i], lon1[i], lat2[i], lon2[i]);
+        if (std::fabs(out[i] - exact) > 2e-12 * exact)
+            return false;
+    }
+
+    // Equirectangular on short pairs: up to ~0.09 degrees apart at
+    // |lat| <= 75, then again within ~0.0045 degrees (500 m)
+    for (double span : {0.06, 0.003}) {
+        double bound = span > 0.01 ? 2e-6 : 1e-8;
+        for (int i = 0; i < SAMPLES; ++i) {
+            lat1[i] = uniform(-75.0, 75.0);
+            lon1[i] = uniform(-180.0, 180.0);
+            lat2[i] = lat1[i] + uniform(-span, span);
+            lon2[i] = lon1[i] + uniform(-span, span);
+        }
+        batchLanes<L>(lat1, lon1, lat2, lon2, out, SAMPLES, true);
+        for (int i = 0; i < SAMPLES; ++i) {
+            double exact = GeoDistance::haversine(lat1[i], lon1[i], lat2[i], lon2[i]);
+            if (exact < GeoDistance::FAST_MAX_KM && std::fabs(out[i] - exact) > bound * exact)
+                return false;
+        }
+    }
+    return true;
+}
+
+}
+
+double GeoDistance::haversine(double lat1, double lon1, double lat2, double lon2)
+{
+    double dLat = (lat2 - lat1) * DEG_TO_RAD;
+    double dLon = (lon2 - lon1) * DEG_TO_RAD;
+    double rLat1 = lat1 * DEG_TO_RAD;
+    double rLat2 = lat2 * DEG_TO_RAD;
+
+    double a = std::sin(dLat / 2.0) * std::sin(dLat / 2.0) +
+               std::cos(rLat1) * std::cos(rLat2) *
+                   std::sin(dLon / 2.0) * std::sin(dLon / 2.0);
+
+    double c = 2.0 * std::atan2(std::sqrt(a), std::sqrt(1.0 - a));
+    return EARTH_RADIUS_KM * c;
+}
+
+double GeoDistance::equirectangular(double lat1, double lon1, double lat2, double lon2)
+{
+    double lanes[BestLanes::Width];
+    BestLanes::store(lanes, equirectangularLanes<BestLanes>(BestLanes::set(lat1), BestLanes::set(lon1),
+                                                            BestLanes::set(lat2), BestLanes::set(lon2)));
+    return lanes[0];
+}
+
+double GeoDistance::distance(double lat1, double lon1, double lat2, double lon2,
+                             Precision precision)
+{
+    return distanceOne<BestLanes>(lat1, lon1, lat2, lon2, precision == Fast);
+}
+
+void GeoDistance::batch(const double* lat1, const double* lon1,
+                        const double* lat2, const double* lon2,
+                        double* out, int count, Precision precision)
+{
+    batchLanes<BestLanes>(lat1, lon1, lat2, lon2, out, count, precision == Fast);
+}
+
+bool GeoDistance::checkAccuracy(const char** failedLanes)
+{
+    const char* failed = nullptr;
+    if (!withinBounds<ScalarLanes>())
+        failed = "scalar";
+#if defined(GEO_DISTANCE_SSE2)
+    else if (!withinBounds<Sse2Lanes>())
+        failed = "sse2";
+#endif
+#if defined(GEO_DISTANCE_AVX2)
+    else if (!withinBounds<Avx2Lanes>())
+        failed = "avx2";
+#endif
+
+    if (failedLanes)
+        *failedLanes = failed;
+    return !failed;
+}
+
+const char* GeoDistance::instructionSet()
+{
+#if defined(GEO_DISTANCE_AVX2)
+    return "avx2";
+#elif defined(GEO_DISTANCE_SSE2)
+    return "sse2";
+#else
+    return "scalar";
+#endif
+}
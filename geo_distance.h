@@ -0,0 +1,46 @@
+#ifndef GEO_DISTANCE_H
+#define GEO_DISTANCE_H
+
+// Great-circle distances on a spherical Earth, one pair at a time or in
+// batches. The batch kernel evaluates several pairs per instruction with
+// AVX2+FMA or SSE2, whichever the build targets, and falls back to plain
+// scalar code otherwise. Within one build every pair, including single
+// pairs and batch tails, runs through the same lane code, so batch(),
+// distance() and equirectangular() agree bit for bit. Builds for different
+// instruction sets can differ in the last bits (AVX2 fuses multiply-adds).
+//
+// Accuracy, relative to the libm haversine:
+//   - batch haversine: below 2e-12 everywhere
+//   - equirectangular, for pairs shorter than FAST_MAX_KM at |lat| <= 75:
+//     below 2e-6 (2 cm per 10 km); below 1e-8 for pairs under 500 m
+class GeoDistance
+{
+public:
+    static constexpr double EARTH_RADIUS_KM = 6371.0;
+    static constexpr double FAST_MAX_KM = 10.0;
+
+    enum Precision {
+        Exact,   // haversine for every pair
+        Fast     // equirectangular for pairs shorter than FAST_MAX_KM
+    };
+
+    static double haversine(double lat1, double lon1, double lat2, double lon2);
+    static double equirectangular(double lat1, double lon1, double lat2, double lon2);
+    static double distance(double lat1, double lon1, double lat2, double lon2,
+                           Precision precision);   // same choice as batch()
+
+    // out[i] = distance in km between (lat1[i], lon1[i]) and (lat2[i], lon2[i]),
+    // coordinates in degrees. The arrays may not overlap out.
+    static void batch(const double* lat1, const double* lon1,
+                      const double* lat2, const double* lon2,
+                      double* out, int count, Precision precision = Exact);
+
+    static const char* instructionSet();   // "avx2", "sse2" or "scalar"
+
+    // Checks every lane type compiled into this build against haversine()
+    // on a fixed sample and the bounds above. On failure, *failedLanes
+    // names the first lane type out of bounds.
+    static bool checkAccuracy(const char** failedLanes = nullptr);
+};
+
+#endif // GEO_DISTANCE_H
@@ -1,24 +1,324 @@
 #include "graph.h"
+#include "string_pool.h"
+#include "geo_distance.h"
 #include <QFile>
 #include <QXmlStreamReader>
 #include <QtMath>
 #include <QSet>
+#include <QHash>
 #include <QPair>
+#include <QtConcurrent>
 #include <limits>
 #include <algorithm>
+#include <queue>
+#include <vector>
+#include <functional>
+
+namespace {
+
+// Per-thread distance labels indexed by dense node index. Only entries
+// touched by a search are reset afterwards, so a bounded search costs
+// O(reached) rather than O(N) even on a large map. prev is only
+// meaningful for touched entries.
+struct SearchScratch {
+    QVector<double> dist;
+    QVector<int> prev;
+    QVector<int> touched;
+
+    void prepare(int nodeCount)
+    {
+        if (dist.size() < nodeCount) {
+            dist.resize(nodeCount);
+            prev.resize(nodeCount);
+            std::fill(dist.begin(), dist.end(), std::numeric_limits<double>::infinity());
+        }
+    }
+
+    void reset()
+    {
+        for (int index : touched) {
+            dist[index] = std::numeric_limits<double>::infinity();
+        }
+        touched.clear();
+    }
+};
+
+thread_local SearchScratch searchScratch;
+
+const double IMPASSABLE = std::numeric_limits<double>::infinity();
+const quint64 LAYOUT_HASH_BASIS = 14695981039346656037ULL;  // FNV-1a offset basis
+
+// Routing metric policies. Each one is only consulted while its weight
+// array is built; the search kernel itself just adds up array entries, so
+// every instantiation gets the same tight relaxation loop.
+struct DistanceMetric {
+    static const Graph::RouteMetric Id = Graph::ShortestDistance;
+    static bool allows(const Graph::Edge&) { return true; }
+    static double cost(const Graph::Edge& edge) { return edge.distance; }
+};
+
+struct FreeFlowTimeMetric {
+    static const Graph::RouteMetric Id = Graph::FreeFlowTime;
+    static bool allows(const Graph::Edge&) { return true; }
+    static double cost(const Graph::Edge& edge)
+    {
+        return edge.distance / edge.speedLimit * 60.0;
+    }
+};
+
+struct TruckMetric {
+    static const Graph::RouteMetric Id = Graph::TruckTime;
+    static constexpr float MAX_SPEED = 80.0f;         // km/h
+    static constexpr double MINOR_ROAD_PENALTY = 2.0;
+
+    static bool allows(const Graph::Edge& edge) { return edge.truckAllowed; }
+    static double cost(const Graph::Edge& edge)
+    {
+        double minutes = edge.distance / qMin(edge.speedLimit, MAX_SPEED) * 60.0;
+        return edge.roadClass >= Graph::Residential ? minutes * MINOR_ROAD_PENALTY : minutes;
+    }
+};
+
+}
 
 Graph::Graph()
+    : revision(0),
+    congestionStamp(0),
+    layoutHashValue(LAYOUT_HASH_BASIS)
+{
+}
+
+const Graph::Node& Graph::getNode(qint64 id) const
+{
+    static const Node missing = {0, 0.0, 0.0, QPointF(), StringPool::Empty, StringPool::Empty};
+
+    auto it = nodes.constFind(id);
+    return it != nodes.constEnd() ? it.value() : missing;
+}
+
+void Graph::addNode(qint64 id, double lat, double lon,
+                    const QString& name, const QString& streetName)
+{
+    StringPool& pool = StringPool::global();
+
+    Node node;
+    node.id = id;
+    node.lat = lat;
+    node.lon = lon;
+    node.pos = QPointF(lon, lat);
+    node.nameId = pool.intern(name);
+    node.streetNameId = pool.intern(streetName);
+    insertNode(node);
+}
+
+// Insert or replace a node, giving new ids the next dense index
+void Graph::insertNode(const Node& node)
+{
+    if (!denseIndex.contains(node.id)) {
+        denseIndex.insert(node.id, denseIds.size());
+        denseIds.append(node.id);
+        layoutHashValue = extendLayoutHash(layoutHashValue, node.id);
+        revision++;
+    }
+    nodes[node.id] = node;
+}
+
+void Graph::swap(Graph& other)
+{
+    nodes.swap(other.nodes);
+    adj.swap(other.adj);
+    incoming.swap(other.incoming);
+    nameToNodeId.swap(other.nameToNodeId);
+    ways.swap(other.ways);
+    denseIndex.swap(other.denseIndex);
+    denseIds.swap(other.denseIds);
+    std::swap(layoutHashValue, other.layoutHashValue);
+
+    // Both graphs changed, so neither may reuse a revision seen before.
+    // Derived routing data moves with the graph it describes and stays
+    // valid if it was current before the swap.
+    QMutexLocker locker(&routingLock);
+    QMutexLocker otherLocker(&other.routingLock);
+
+    quint64 oldRevision = revision;
+    quint64 otherOldRevision = other.revision;
+    revision = other.revision = qMax(revision, other.revision) + 1;
+
+    auto carry = [&](quint64& cachedRevision, quint64& otherCachedRevision) {
+        std::swap(cachedRevision, otherCachedRevision);
+        if (cachedRevision == otherOldRevision) {
+            cachedRevision = revision;
+        }
+        if (otherCachedRevision == oldRevision) {
+            otherCachedRevision = other.revision;
+        }
+    };
+
+    std::swap(congestionStamp, other.congestionStamp);
+    std::swap(routingTopology, other.routingTopology);
+    carry(routingTopology.revision, other.routingTopology.revision);
+    for (int m = 0; m < RouteMetricCount; ++m) {
+        std::swap(metricWeights[m], other.metricWeights[m]);
+        carry(metricWeights[m].revision, other.metricWeights[m].revision);
+    }
+    std::swap(componentLabels, other.componentLabels);
+    carry(componentLabels.revision, other.componentLabels.revision);
+}
+
+// 64-bit FNV-1a over the dense ids as little-endian bytes, extended one
+// id at a time. The value is stored in checkpoints, so unlike qHash it must
+// not depend on the Qt build, the CPU or a per-process seed.
+quint64 Graph::extendLayoutHash(quint64 hash, qint64 id)
 {
+    quint64 value = quint64(id);
+    for (int byte = 0; byte < 8; ++byte) {
+        hash ^= (value >> (byte * 8)) & 0xff;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
 }
 
 void Graph::clear()
 {
     nodes.clear();
     adj.clear();
+    incoming.clear();
+    ways.clear();
+    denseIndex.clear();
+    denseIds.clear();
+    layoutHashValue = LAYOUT_HASH_BASIS;
     nameToNodeId.clear();
+    revision++;
+}
+
+Graph::Node Graph::readNode(QXmlStreamReader& xml)
+{
+    Node node;
+    node.id = xml.attributes().value("id").toLongLong();
+    node.lat = xml.attributes().value("lat").toDouble();
+    node.lon = xml.attributes().value("lon").toDouble();
+    node.pos = QPointF(node.lon, node.lat);
+
+    // Name candidates are only materialised when they win; keys are
+    // compared as views straight from the reader, without copying
+    QString name;
+    QString streetName;
+
+    // Read all tags for this node
+    while (!xml.atEnd() && !(xml.isEndElement() && xml.name() == QString("node"))) {
+        xml.readNext();
+
+        if (xml.isStartElement() && xml.name() == QString("tag")) {
+            const QXmlStreamAttributes attrs = xml.attributes();
+            QStringView key = attrs.value("k");
+            QStringView value = attrs.value("v");
+
+            // Priority order for node names
+            if (key == u"name" && name.isEmpty()) {
+                name = value.toString();
+            } else if (key == u"name:en" && name.isEmpty()) {
+                name = value.toString();
+            } else if (key == u"addr:street" && streetName.isEmpty()) {
+                streetName = value.toString();
+            } else if (key == u"addr:suburb" && name.isEmpty()) {
+                name = value.toString();
+            } else if (key == u"addr:district" && name.isEmpty()) {
+                name = value.toString();
+            } else if (key == u"place" && name.isEmpty()) {
+                name = value.toString() + " Area";
+            } else if (key == u"amenity" && name.isEmpty()) {
+                name = value.toString().replace("_", " ");
+            } else if (key == u"shop" && name.isEmpty()) {
+                name = value.toString().replace("_", " ") + " Shop";
+            }
+        }
+    }
+
+    StringPool& pool = StringPool::global();
+    node.nameId = pool.intern(name);
+    node.streetNameId = pool.intern(streetName);
+
+    return node;
+}
+
+bool Graph::readWay(QXmlStreamReader& xml, qint64& wayId, Way& way)
+{
+    wayId = xml.attributes().value("id").toLongLong();
+    bool isRoad = false;
+    bool reversed = false;
+    StringPool& pool = StringPool::global();
+
+    while (!xml.atEnd() && !(xml.isEndElement() && xml.name() == QString("way"))) {
+        xml.readNext();
+
+        if (xml.isStartElement() && xml.name() == QString("nd")) {
+            qint64 nodeRef = xml.attributes().value("ref").toLongLong();
+            way.nodeIds.append(nodeRef);
+        }
+
+        if (xml.isStartElement() && xml.name() == QString("tag")) {
+            const QXmlStreamAttributes attrs = xml.attributes();
+            QStringView key = attrs.value("k");
+            QStringView value = attrs.value("v");
+
+            // Check if this way is a road
+            if (key == u"highway") {
+                isRoad = true;
+                way.roadTypeId = pool.intern(value);
+            } else if (key == u"maxspeed") {
+                way.maxSpeed = parseMaxSpeed(value);
+            } else if (key == u"hgv") {
+                way.truckAllowed = value != u"no";
+            } else if (key == u"oneway") {
+                way.oneWay = value == u"yes" || value == u"true" || value == u"1" || value == u"-1";
+                reversed = value == u"-1";
+            } else if (key == u"junction" && value == u"roundabout") {
+                way.oneWay = true;
+            }
+
+            // Extract road/street name
+            if (key == u"name") {
+                way.nameId = pool.intern(value);
+            } else if (key == u"name:en" && way.nameId == StringPool::Empty) {
+                way.nameId = pool.intern(value);
+            } else if (key == u"addr:street" && way.nameId == StringPool::Empty) {
+                way.nameId = pool.intern(value);
+            }
+        }
+    }
+
+    // oneway=-1 runs against the node order; store it in travel order
+    if (reversed) {
+        std::reverse(way.nodeIds.begin(), way.nodeIds.end());
+    }
+
+    // Only roads with at least one node are of interest
+    return isRoad && !way.nodeIds.isEmpty();
+}
+
+void Graph::assignStreetName(const Way& way)
+{
+    if (way.nameId == StringPool::Empty) {
+        return;
+    }
+
+    // Assign street name to nodes that don't have one
+    for (qint64 nodeId : way.nodeIds) {
+        auto it = nodes.find(nodeId);
+        if (it == nodes.end()) {
+            continue;
+        }
+        if (it->streetNameId == StringPool::Empty) {
+            it->streetNameId = way.nameId;
+        }
+        // If node has no name at all, use street name
+        if (it->nameId == StringPool::Empty) {
+            it->nameId = way.nameId;
+        }
+    }
 }
 
-bool Graph::loadFromOSM(const QString& filePath)
+bool Graph::loadFromOSM(const QString& filePath, const LoadProgress& progress)
 {
     clear();
 
@@ -29,128 +329,84 @@ bool Graph::loadFromOSM(const QString& filePath)
 
     QXmlStreamReader xml(&file);
 
+    // The file is read twice, so progress runs over twice its size
+    const qint64 totalBytes = 2 * file.size();
+    const int REPORT_EVERY = 4096;  // XML tokens between progress callbacks
+    int tokens = 0;
+    auto keepGoing = [&](qint64 passOffset) {
+        if (!progress || ++tokens % REPORT_EVERY != 0) {
+            return true;
+        }
+        return progress(passOffset + file.pos(), totalBytes);
+    };
+
     // First pass: Read all nodes and their tags
     while (!xml.atEnd()) {
         xml.readNext();
 
-        if (xml.isStartElement() && xml.name() == QString("node")) {
-            Node node;
-            node.id = xml.attributes().value("id").toLongLong();
-            node.lat = xml.attributes().value("lat").toDouble();
-            node.lon = xml.attributes().value("lon").toDouble();
-            node.pos = QPointF(node.lon, node.lat);
-
-            // Read all tags for this node
-            while (!(xml.isEndElement() && xml.name() == QString("node"))) {
-                xml.readNext();
-
-                if (xml.isStartElement() && xml.name() == QString("tag")) {
-                    QString key = xml.attributes().value("k").toString();
-                    QString value = xml.attributes().value("v").toString();
-
-                    // Priority order for node names
-                    if (key == "name" && node.name.isEmpty()) {
-                        node.name = value;
-                    } else if (key == "name:en" && node.name.isEmpty()) {
-                        node.name = value;
-                    } else if (key == "addr:street" && node.streetName.isEmpty()) {
-                        node.streetName = value;
-                    } else if (key == "addr:suburb" && node.name.isEmpty()) {
-                        node.name = value;
-                    } else if (key == "addr:district" && node.name.isEmpty()) {
-                        node.name = value;
-                    } else if (key == "place" && node.name.isEmpty()) {
-                        node.name = value + " Area";
-                    } else if (key == "amenity" && node.name.isEmpty()) {
-                        node.name = value.replace("_", " ");
-                    } else if (key == "shop" && node.name.isEmpty()) {
-                        node.name = value.replace("_", " ") + " Shop";
-                    }
-                }
-            }
+        if (!keepGoing(0)) {
+            clear();
+            return false;
+        }
 
-            nodes[node.id] = node;
+        if (xml.isStartElement() && xml.name() == QString("node")) {
+            Node node = readNode(xml);
+            insertNode(node);
         }
     }
 
-    // Second pass: Read ways and build edges, extract street names
+    // Second pass: Read ways and build edges, extract street names.
+    // Segments are collected first so their lengths can be measured in one
+    // vectorised batch.
     file.seek(0);
     xml.setDevice(&file);
 
-    QMap<qint64, QString> wayToStreetName;
+    struct Segment {
+        qint64 from;
+        qint64 to;
+        RoadClass roadClass;
+        float maxSpeed;
+        bool truckAllowed;
+        bool oneWay;
+    };
+    QVector<Segment> segments;
+    QVector<double> fromLat, fromLon, toLat, toLon;
 
     while (!xml.atEnd()) {
         xml.readNext();
 
-        if (xml.isStartElement() && xml.name() == QString("way")) {
-            qint64 wayId = xml.attributes().value("id").toLongLong();
-            QList<qint64> wayNodes;
-            QString wayName;
-            QString roadType;
-            bool isRoad = false;
-
-            while (!(xml.isEndElement() && xml.name() == QString("way"))) {
-                xml.readNext();
-
-                if (xml.isStartElement() && xml.name() == QString("nd")) {
-                    qint64 nodeRef = xml.attributes().value("ref").toLongLong();
-                    wayNodes.append(nodeRef);
-                }
-
-                if (xml.isStartElement() && xml.name() == QString("tag")) {
-                    QString key = xml.attributes().value("k").toString();
-                    QString value = xml.attributes().value("v").toString();
-
-                    // Check if this way is a road
-                    if (key == "highway") {
-                        isRoad = true;
-                        roadType = value;
-                    }
+        if (!keepGoing(totalBytes / 2)) {
+            clear();
+            return false;
+        }
 
-                    // Extract road/street name
-                    if (key == "name") {
-                        wayName = value;
-                    } else if (key == "name:en" && wayName.isEmpty()) {
-                        wayName = value;
-                    } else if (key == "addr:street" && wayName.isEmpty()) {
-                        wayName = value;
-                    }
-                }
-            }
+        if (xml.isStartElement() && xml.name() == QString("way")) {
+            qint64 wayId;
+            Way way;
 
             // Only process if it's actually a road
-            if (isRoad && !wayNodes.isEmpty()) {
-                // Assign street name to nodes that don't have one
-                if (!wayName.isEmpty()) {
-                    for (qint64 nodeId : wayNodes) {
-                        if (nodes.contains(nodeId)) {
-                            if (nodes[nodeId].streetName.isEmpty()) {
-                                nodes[nodeId].streetName = wayName;
-                            }
-                            // If node has no name at all, use street name
-                            if (nodes[nodeId].name.isEmpty()) {
-                                nodes[nodeId].name = wayName;
-                            }
-                        }
+            if (readWay(xml, wayId, way)) {
+                assignStreetName(way);
+
+                // Collect segments between consecutive nodes
+                RoadClass roadClass = roadClassOf(way.roadType());
+                for (int i = 0; i < way.nodeIds.size() - 1; ++i) {
+                    auto n1 = nodes.constFind(way.nodeIds[i]);
+                    auto n2 = nodes.constFind(way.nodeIds[i + 1]);
+                    if (n1 == nodes.constEnd() || n2 == nodes.constEnd()) {
+                        continue;
                     }
-                }
-
-                // Create edges between consecutive nodes
-                for (int i = 0; i < wayNodes.size() - 1; ++i) {
-                    qint64 from = wayNodes[i];
-                    qint64 to = wayNodes[i + 1];
 
-                    if (nodes.contains(from) && nodes.contains(to)) {
-                        Node n1 = nodes[from];
-                        Node n2 = nodes[to];
-
-                        double dist = haversineDistance(n1.lat, n1.lon, n2.lat, n2.lon);
-
-                        // Add bidirectional edges
-                        addEdge(from, to, dist);
-                        addEdge(to, from, dist);
-                    }
+                    segments.append({n1->id, n2->id, roadClass, way.maxSpeed, way.truckAllowed,
+                                    way.oneWay});
+                    fromLat.append(n1->lat);
+                    fromLon.append(n1->lon);
+                    toLat.append(n2->lat);
+                    toLon.append(n2->lon);
                 }
+
+                // Kept so change files can later update or remove the way
+                ways.insert(wayId, way);
             }
         }
     }
@@ -161,9 +417,34 @@ bool Graph::loadFromOSM(const QString& filePath)
         return false;
     }
 
+    // Road segments are short, so the equirectangular fast path applies to
+    // nearly all of them (see GeoDistance for the error bound)
+    QVector<double> lengths(segments.size());
+    GeoDistance::batch(fromLat.constData(), fromLon.constData(),
+                       toLat.constData(), toLon.constData(),
+                       lengths.data(), segments.size(), GeoDistance::Fast);
+
+    // Add edges, in both directions unless the way is one-way
+    for (int i = 0; i < segments.size(); ++i) {
+        const Segment& segment = segments[i];
+        addEdge(segment.from, segment.to, lengths[i],
+                segment.roadClass, segment.maxSpeed, segment.truckAllowed);
+        if (!segment.oneWay) {
+            addEdge(segment.to, segment.from, lengths[i],
+                    segment.roadClass, segment.maxSpeed, segment.truckAllowed);
+        }
+    }
+
     // Generate smart display names for all nodes
     generateDisplayNames();
 
+    // Label components now, while still off the caller's UI thread
+    components();
+
+    if (progress) {
+        progress(totalBytes, totalBytes);
+    }
+
     return true;
 }
 
@@ -179,10 +460,10 @@ void Graph::generateDisplayNames()
         QString baseName;
 
         // Determine base name
-        if (!node.name.isEmpty()) {
-            baseName = node.name;
-        } else if (!node.streetName.isEmpty()) {
-            baseName = node.streetName;
+        if (node.nameId != StringPool::Empty) {
+            baseName = node.name().toString();
+        } else if (node.streetNameId != StringPool::Empty) {
+            baseName = node.streetName().toString();
         } else {
             baseName = "Unnamed Location";
         }
@@ -199,7 +480,7 @@ void Graph::generateDisplayNames()
         if (nodeIds.size() == 1) {
             // Unique name - just add coordinates
             qint64 nodeId = nodeIds.first();
-            Node node = nodes[nodeId];
+            const Node& node = nodes[nodeId];
             QString displayName = QString("%1 (%2, %3)")
                                       .arg(baseName)
                                       .arg(node.lat, 0, 'f', 4)
@@ -209,7 +490,7 @@ void Graph::generateDisplayNames()
             // Multiple nodes with same name - add more context
             for (int i = 0; i < nodeIds.size(); ++i) {
                 qint64 nodeId = nodeIds[i];
-                Node node = nodes[nodeId];
+                const Node& node = nodes[nodeId];
 
                 QString displayName;
                 if (baseName == "Unnamed Location") {
@@ -236,10 +517,10 @@ QString Graph::generateNodeName(const Node& node, int index) const
 {
     QString name;
 
-    if (!node.name.isEmpty()) {
-        name = node.name;
-    } else if (!node.streetName.isEmpty()) {
-        name = node.streetName;
+    if (node.nameId != StringPool::Empty) {
+        name = node.name().toString();
+    } else if (node.streetNameId != StringPool::Empty) {
+        name = node.streetName().toString();
     } else {
         name = QString("Intersection #%1").arg(index);
     }
@@ -302,45 +583,254 @@ QString Graph::getNodeDisplayName(qint64 nodeId) const
 
 double Graph::haversineDistance(double lat1, double lon1, double lat2, double lon2)
 {
-    const double R = 6371.0;
-    double dLat = qDegreesToRadians(lat2 - lat1);
-    double dLon = qDegreesToRadians(lon2 - lon1);
-    double rLat1 = qDegreesToRadians(lat1);
-    double rLat2 = qDegreesToRadians(lat2);
-
-    double a = qSin(dLat / 2.0) * qSin(dLat / 2.0) +
-               qCos(rLat1) * qCos(rLat2) *
-                   qSin(dLon / 2.0) * qSin(dLon / 2.0);
-
-    double c = 2.0 * qAtan2(qSqrt(a), qSqrt(1.0 - a));
-    double distance = R * c;
-
-    return distance;
+    return GeoDistance::haversine(lat1, lon1, lat2, lon2);
 }
 
-void Graph::addEdge(qint64 from, qint64 to, double distance)
+// Ways that share a segment share its edge: the segment keeps the most
+// permissive attributes of the ways using it, so closing it closes the road
+void Graph::addEdge(qint64 from, qint64 to, double distance,
+                    RoadClass roadClass, float speedLimit, bool truckAllowed)
 {
+    if (speedLimit <= 0.0f) {
+        speedLimit = defaultSpeed(roadClass);
+    }
+
+    Edge* existing = findMutableEdge(from, to);
+    if (existing) {
+        existing->distance = distance;
+        existing->roadClass = qMin(existing->roadClass, roadClass);
+        existing->speedLimit = qMax(existing->speedLimit, speedLimit);
+        existing->truckAllowed = existing->truckAllowed || truckAllowed;
+        revision++;
+        return;
+    }
+
     Edge edge;
     edge.to = to;
     edge.distance = distance;
+    edge.congestion = 1.0;
+    edge.closed = false;
+    edge.roadClass = roadClass;
+    edge.truckAllowed = truckAllowed;
+    edge.speedLimit = speedLimit;
 
     adj[from].append(edge);
+    incoming[to].append(from);
+    revision++;
+}
+
+Graph::RoadClass Graph::roadClassOf(QStringView highway)
+{
+    // Link roads ("primary_link") share the class of the road they join
+    if (highway.endsWith(u"_link")) {
+        highway.chop(5);
+    }
+
+    if (highway == u"motorway") {
+        return Motorway;
+    } else if (highway == u"trunk") {
+        return Trunk;
+    } else if (highway == u"primary") {
+        return Primary;
+    } else if (highway == u"secondary") {
+        return Secondary;
+    } else if (highway == u"tertiary") {
+        return Tertiary;
+    } else if (highway == u"residential" || highway == u"unclassified" ||
+               highway == u"living_street") {
+        return Residential;
+    } else if (highway == u"service") {
+        return Service;
+    }
+    return OtherRoad;
+}
+
+float Graph::defaultSpeed(RoadClass roadClass)
+{
+    switch (roadClass) {
+    case Motorway:    return 100.0f;
+    case Trunk:       return 80.0f;
+    case Primary:     return 60.0f;
+    case Secondary:   return 50.0f;
+    case Tertiary:    return 40.0f;
+    case Residential: return 30.0f;
+    case Service:     return 20.0f;
+    default:          return 30.0f;
+    }
+}
+
+// "50", "50 km/h" and "30 mph" are understood; zone values such as
+// "PK:urban", "none" or "walk" yield 0 so the class default applies
+float Graph::parseMaxSpeed(QStringView value)
+{
+    value = value.trimmed();
+    int digits = 0;
+    while (digits < value.size() && (value[digits].isDigit() || value[digits] == u'.')) {
+        digits++;
+    }
+
+    bool ok = false;
+    float speed = value.left(digits).toFloat(&ok);
+    if (!ok || speed <= 0.0f) {
+        return 0.0f;
+    }
+    return value.mid(digits).trimmed() == u"mph" ? speed * 1.609344f : speed;
+}
+
+const Graph::Edge* Graph::findEdge(qint64 from, qint64 to) const
+{
+    auto it = adj.constFind(from);
+    if (it == adj.constEnd()) {
+        return nullptr;
+    }
+
+    for (const Edge& edge : it.value()) {
+        if (edge.to == to) {
+            return &edge;
+        }
+    }
+    return nullptr;
+}
+
+bool Graph::setEdgeCongestion(qint64 from, qint64 to, double factor)
+{
+    auto it = adj.find(from);
+    if (it == adj.end()) {
+        return false;
+    }
+
+    for (Edge& edge : it.value()) {
+        if (edge.to == to) {
+            edge.congestion = qMax(1.0, factor);
+            congestionStamp++;
+            return true;
+        }
+    }
+    return false;
+}
+
+void Graph::resetCongestion()
+{
+    for (auto it = adj.begin(); it != adj.end(); ++it) {
+        for (Edge& edge : it.value()) {
+            edge.congestion = 1.0;
+        }
+    }
+    congestionStamp++;
 }
 
 int Graph::getEdgeCount() const
 {
+    // A two-way segment is counted from its lower id end only
     int count = 0;
-    for (const auto& edgeList : adj) {
-        count += edgeList.size();
+    for (auto it = adj.cbegin(); it != adj.cend(); ++it) {
+        for (const Edge& edge : it.value()) {
+            if (it.key() < edge.to || !findEdge(edge.to, it.key())) {
+                count++;
+            }
+        }
+    }
+    return count;
+}
+
+Graph::PathResult Graph::dijkstra(qint64 source, qint64 destination, RouteMetric metric) const
+{
+    // Pairs in different components would otherwise cost a search of the
+    // whole source component
+    if (hasNode(source) && hasNode(destination) && !mayReach(source, destination)) {
+        PathResult result;
+        result.found = false;
+        result.totalDistance = 0.0;
+        result.totalCost = 0.0;
+        result.errorMessage = "No path found between source and destination";
+        return result;
+    }
+
+    // One switch per query picks the kernel; nothing is decided per edge
+    switch (metric) {
+    case FreeFlowTime:
+        return shortestPath<FreeFlowTimeMetric>(source, destination);
+    case TruckTime:
+        return shortestPath<TruckMetric>(source, destination);
+    default:
+        return shortestPath<DistanceMetric>(source, destination);
+    }
+}
+
+// Calls visit(fromIndex, toIndex, edge) for every edge whose endpoints
+// both have a dense index, in dense order. Topology and weight arrays are
+// built with the same walk, so their entries line up.
+template <typename Visit>
+void Graph::forEachRoutingEdge(Visit visit) const
+{
+    for (int from = 0; from < denseIds.size(); ++from) {
+        auto it = adj.constFind(denseIds[from]);
+        if (it == adj.constEnd()) {
+            continue;
+        }
+        for (const Edge& edge : it.value()) {
+            int to = nodeIndexOf(edge.to);
+            if (to >= 0) {
+                visit(from, to, edge);
+            }
+        }
+    }
+}
+
+void Graph::rebuildRoutingTopology() const
+{
+    RoutingTopology topology;
+    topology.revision = revision;
+    topology.offsets.fill(0, denseIds.size() + 1);
+
+    forEachRoutingEdge([&](int from, int to, const Edge&) {
+        topology.offsets[from + 1]++;
+        topology.targets.append(to);
+    });
+    for (int i = 0; i < denseIds.size(); ++i) {
+        topology.offsets[i + 1] += topology.offsets[i];
+    }
+
+    routingTopology = topology;
+}
+
+template <typename Metric>
+void Graph::routingArrays(RoutingTopology& topology, QVector<double>& weights) const
+{
+    QMutexLocker locker(&routingLock);
+
+    if (routingTopology.revision != revision) {
+        rebuildRoutingTopology();
     }
-    return count / 2;
+
+    MetricWeights& cached = metricWeights[Metric::Id];
+    if (cached.revision != revision || cached.congestionStamp != congestionStamp) {
+        QVector<double> built;
+        built.reserve(routingTopology.targets.size());
+        forEachRoutingEdge([&](int, int, const Edge& edge) {
+            bool passable = !edge.closed && Metric::allows(edge);
+            built.append(passable ? Metric::cost(edge) * edge.congestion : IMPASSABLE);
+        });
+
+        cached.weights = built;
+        cached.revision = revision;
+        cached.congestionStamp = congestionStamp;
+    }
+
+    topology = routingTopology;
+    weights = cached.weights;
 }
 
-Graph::PathResult Graph::dijkstra(qint64 source, qint64 destination)
+// Binary-heap Dijkstra with lazy deletion over the CSR arrays. Impassable
+// edges carry an infinite weight, so the relaxation loop has no per-edge
+// tests besides the distance comparison.
+template <typename Metric>
+Graph::PathResult Graph::shortestPath(qint64 source, qint64 destination) const
 {
     PathResult result;
     result.found = false;
     result.totalDistance = 0.0;
+    result.totalCost = 0.0;
 
     if (!hasNode(source)) {
         result.errorMessage = "Source node not found in graph";
@@ -357,68 +847,686 @@ Graph::PathResult Graph::dijkstra(qint64 source, qint64 destination)
         return result;
     }
 
-    const double INF = std::numeric_limits<double>::infinity();
-    QMap<qint64, double> dist;
-    QMap<qint64, qint64> prev;
-    QSet<qint64> visited;
+    RoutingTopology topology;
+    QVector<double> weights;
+    routingArrays<Metric>(topology, weights);
+    const int* offsets = topology.offsets.constData();
+    const int* targets = topology.targets.constData();
+    const double* weight = weights.constData();
 
-    for (qint64 nodeId : nodes.keys()) {
-        dist[nodeId] = INF;
-    }
-    dist[source] = 0.0;
+    SearchScratch& scratch = searchScratch;
+    scratch.prepare(denseIds.size());
+    double* dist = scratch.dist.data();
+    int* prev = scratch.prev.data();
 
-    while (true) {
-        qint64 current = -1;
-        double minDist = INF;
+    int sourceIndex = nodeIndexOf(source);
+    int destinationIndex = nodeIndexOf(destination);
 
-        for (qint64 nodeId : nodes.keys()) {
-            if (!visited.contains(nodeId) && dist[nodeId] < minDist) {
-                minDist = dist[nodeId];
-                current = nodeId;
-            }
-        }
+    typedef std::pair<double, int> QueueEntry;
+    std::priority_queue<QueueEntry, std::vector<QueueEntry>, std::greater<QueueEntry>> queue;
 
-        if (current == -1 || minDist == INF) {
-            break;
-        }
+    dist[sourceIndex] = 0.0;
+    prev[sourceIndex] = -1;
+    scratch.touched.append(sourceIndex);
+    queue.push(QueueEntry(0.0, sourceIndex));
+
+    while (!queue.empty()) {
+        QueueEntry top = queue.top();
+        queue.pop();
 
-        if (current == destination) {
+        int current = top.second;
+        if (top.first > dist[current]) {
+            continue;  // stale entry
+        }
+        if (current == destinationIndex) {
             break;
         }
 
-        visited.insert(current);
-
-        for (const Edge& edge : adj[current]) {
-            if (!visited.contains(edge.to)) {
-                double newDist = dist[current] + edge.distance;
-                if (newDist < dist[edge.to]) {
-                    dist[edge.to] = newDist;
-                    prev[edge.to] = current;
+        for (int e = offsets[current]; e < offsets[current + 1]; ++e) {
+            int next = targets[e];
+            double newDist = top.first + weight[e];
+            if (newDist < dist[next]) {
+                if (dist[next] == IMPASSABLE) {
+                    scratch.touched.append(next);
                 }
+                dist[next] = newDist;
+                prev[next] = current;
+                queue.push(QueueEntry(newDist, next));
             }
         }
     }
 
-    if (dist[destination] == INF) {
+    if (dist[destinationIndex] == IMPASSABLE) {
+        scratch.reset();
         result.errorMessage = "No path found between source and destination";
         return result;
     }
 
     QVector<qint64> path;
-    qint64 current = destination;
-    while (current != source) {
-        path.prepend(current);
-        if (!prev.contains(current)) {
-            result.errorMessage = "Path reconstruction failed";
-            return result;
+    double totalDistance = 0.0;
+    for (int index = destinationIndex; index != sourceIndex; index = prev[index]) {
+        qint64 to = denseIds[index];
+        qint64 from = denseIds[prev[index]];
+        const Edge* edge = findEdge(from, to);
+        if (edge) {
+            totalDistance += edge->distance;
         }
-        current = prev[current];
+        path.append(to);
     }
-    path.prepend(source);
+    path.append(source);
+    std::reverse(path.begin(), path.end());
 
     result.found = true;
     result.path = path;
-    result.totalDistance = dist[destination];
+    result.totalDistance = totalDistance;
+    result.totalCost = dist[destinationIndex];
+
+    scratch.reset();
+    return result;
+}
+
+// ----------------------------------------------------------------------
+// Connected components
+// ----------------------------------------------------------------------
+
+Graph::ComponentLabels Graph::components() const
+{
+    QMutexLocker locker(&routingLock);
+    if (componentLabels.revision != revision) {
+        rebuildComponents();
+    }
+    return componentLabels;
+}
+
+// Iterative Tarjan for strongly connected components plus union-find for
+// weak components, both over open edges only. Caller holds routingLock.
+void Graph::rebuildComponents() const
+{
+    if (routingTopology.revision != revision) {
+        rebuildRoutingTopology();
+    }
+    const int* offsets = routingTopology.offsets.constData();
+    const int* targets = routingTopology.targets.constData();
+    const int nodeCount = denseIds.size();
+
+    QVector<bool> open;
+    open.reserve(routingTopology.targets.size());
+    forEachRoutingEdge([&](int, int, const Edge& edge) {
+        open.append(!edge.closed);
+    });
+
+    ComponentLabels labels;
+    labels.revision = revision;
+    labels.strong.fill(-1, nodeCount);
+
+    QVector<int> order(nodeCount, -1);   // DFS discovery index
+    QVector<int> low(nodeCount, 0);
+    QVector<bool> onStack(nodeCount, false);
+    QVector<int> stack;
+    QVector<QPair<int, int>> frames;     // (node, next edge to look at)
+    QVector<int> sizes;
+    int counter = 0;
+
+    for (int root = 0; root < nodeCount; ++root) {
+        if (order[root] >= 0) {
+            continue;
+        }
+
+        order[root] = low[root] = counter++;
+        stack.append(root);
+        onStack[root] = true;
+        frames.append(qMakePair(root, offsets[root]));
+
+        while (!frames.isEmpty()) {
+            int v = frames.last().first;
+            int e = frames.last().second;
+
+            if (e < offsets[v + 1]) {
+                frames.last().second++;
+                if (!open[e]) {
+                    continue;
+                }
+                int w = targets[e];
+                if (order[w] < 0) {
+                    order[w] = low[w] = counter++;
+                    stack.append(w);
+                    onStack[w] = true;
+                    frames.append(qMakePair(w, offsets[w]));
+                } else if (onStack[w]) {
+                    low[v] = qMin(low[v], order[w]);
+                }
+                continue;
+            }
+
+            // v is done; it roots a component if nothing below reached higher
+            if (low[v] == order[v]) {
+                int label = sizes.size();
+                sizes.append(0);
+                int w;
+                do {
+                    w = stack.takeLast();
+                    onStack[w] = false;
+                    labels.strong[w] = label;
+                    sizes[label]++;
+                } while (w != v);
+            }
+
+            frames.removeLast();
+            if (!frames.isEmpty()) {
+                int parent = frames.last().first;
+                low[parent] = qMin(low[parent], low[v]);
+            }
+        }
+    }
+
+    labels.largest = sizes.isEmpty()
+        ? -1 : int(std::max_element(sizes.cbegin(), sizes.cend()) - sizes.cbegin());
+
+    // Weak components: union-find with path halving
+    QVector<int> parent(nodeCount);
+    for (int i = 0; i < nodeCount; ++i) {
+        parent[i] = i;
+    }
+    auto find = [&parent](int x) {
+        while (parent[x] != x) {
+            parent[x] = parent[parent[x]];
+            x = parent[x];
+        }
+        return x;
+    };
+    for (int v = 0; v < nodeCount; ++v) {
+        for (int e = offsets[v]; e < offsets[v + 1]; ++e) {
+            if (open[e]) {
+                parent[find(v)] = find(targets[e]);
+            }
+        }
+    }
+    labels.weak.resize(nodeCount);
+    for (int i = 0; i < nodeCount; ++i) {
+        labels.weak[i] = find(i);
+    }
+
+    componentLabels = labels;
+}
+
+bool Graph::mayReach(qint64 from, qint64 to) const
+{
+    int a = nodeIndexOf(from);
+    int b = nodeIndexOf(to);
+    if (a < 0 || b < 0) {
+        return false;
+    }
+
+    // Different SCCs of one weak component may still be linked one way
+    ComponentLabels labels = components();
+    return labels.weak[a] == labels.weak[b];
+}
+
+int Graph::componentOf(qint64 id) const
+{
+    int index = nodeIndexOf(id);
+    return index < 0 ? -1 : components().strong[index];
+}
+
+QVector<qint64> Graph::largestComponent() const
+{
+    ComponentLabels labels = components();
+
+    QVector<qint64> ids;
+    for (int i = 0; i < labels.strong.size(); ++i) {
+        if (labels.strong[i] == labels.largest) {
+            ids.append(denseIds[i]);
+        }
+    }
+    return ids;
+}
+
+// ----------------------------------------------------------------------
+// Incremental network updates
+// ----------------------------------------------------------------------
+
+Graph::Edge* Graph::findMutableEdge(qint64 from, qint64 to)
+{
+    auto it = adj.find(from);
+    if (it == adj.end()) {
+        return nullptr;
+    }
+
+    for (Edge& edge : it.value()) {
+        if (edge.to == to) {
+            return &edge;
+        }
+    }
+    return nullptr;
+}
+
+bool Graph::closeEdge(qint64 from, qint64 to)
+{
+    Edge* edge = findMutableEdge(from, to);
+    if (!edge) {
+        return false;
+    }
+    if (!edge->closed) {
+        edge->closed = true;
+        revision++;
+    }
+    return true;
+}
+
+bool Graph::reopenEdge(qint64 from, qint64 to)
+{
+    Edge* edge = findMutableEdge(from, to);
+    if (!edge) {
+        return false;
+    }
+    if (edge->closed) {
+        edge->closed = false;
+        revision++;
+    }
+    return true;
+}
+
+bool Graph::setEdgeDistance(qint64 from, qint64 to, double distance)
+{
+    Edge* edge = findMutableEdge(from, to);
+    if (!edge || distance < 0.0) {
+        return false;
+    }
+    if (edge->distance != distance) {
+        edge->distance = distance;
+        revision++;
+    }
+    return true;
+}
+
+// Open (or create) the edge from -> to with a fresh distance and the
+// way's road attributes
+void Graph::upsertEdge(qint64 from, qint64 to, double distance, const Way& way)
+{
+    RoadClass roadClass = roadClassOf(way.roadType());
+    Edge* edge = findMutableEdge(from, to);
+    if (edge) {
+        edge->distance = distance;
+        edge->closed = false;
+        edge->roadClass = roadClass;
+        edge->truckAllowed = way.truckAllowed;
+        edge->speedLimit = way.maxSpeed > 0.0f ? way.maxSpeed : defaultSpeed(roadClass);
+    } else {
+        addEdge(from, to, distance, roadClass, way.maxSpeed, way.truckAllowed);
+    }
+}
+
+// Close every edge into or out of a node
+void Graph::closeNodeEdges(qint64 nodeId, QSet<EdgeKey>& changed)
+{
+    auto close = [&](qint64 from, qint64 to) {
+        Edge* edge = findMutableEdge(from, to);
+        if (edge && !edge->closed) {
+            edge->closed = true;
+            changed.insert(EdgeKey(from, to));
+        }
+    };
+
+    const QList<Edge> edges = adj.value(nodeId);
+    for (const Edge& edge : edges) {
+        close(nodeId, edge.to);
+    }
+    const QVector<qint64> tails = incoming.value(nodeId);
+    for (qint64 from : tails) {
+        close(from, nodeId);
+    }
+}
+
+// Number of ways that create each directed edge, so a way can give up its
+// segments without closing ones another way still uses
+QHash<Graph::EdgeKey, int> Graph::segmentUses() const
+{
+    QHash<EdgeKey, int> uses;
+    for (const Way& way : ways) {
+        for (int i = 0; i < way.nodeIds.size() - 1; ++i) {
+            uses[EdgeKey(way.nodeIds[i], way.nodeIds[i + 1])]++;
+            if (!way.oneWay) {
+                uses[EdgeKey(way.nodeIds[i + 1], way.nodeIds[i])]++;
+            }
+        }
+    }
+    return uses;
+}
+
+// Close the edges this way created, unless another way still uses them
+void Graph::closeWayEdges(const Way& way, QHash<EdgeKey, int>& uses, QSet<EdgeKey>& changed)
+{
+    auto release = [&](qint64 from, qint64 to) {
+        int& count = uses[EdgeKey(from, to)];
+        if (--count > 0) {
+            return;
+        }
+        count = 0;
+        Edge* edge = findMutableEdge(from, to);
+        if (edge && !edge->closed) {
+            edge->closed = true;
+            changed.insert(EdgeKey(from, to));
+        }
+    };
+
+    for (int i = 0; i < way.nodeIds.size() - 1; ++i) {
+        release(way.nodeIds[i], way.nodeIds[i + 1]);
+        if (!way.oneWay) {
+            release(way.nodeIds[i + 1], way.nodeIds[i]);
+        }
+    }
+}
+
+void Graph::openWayEdges(const Way& way, QHash<EdgeKey, int>& uses, QSet<EdgeKey>& changed)
+{
+    for (int i = 0; i < way.nodeIds.size() - 1; ++i) {
+        qint64 from = way.nodeIds[i];
+        qint64 to = way.nodeIds[i + 1];
+        if (!nodes.contains(from) || !nodes.contains(to)) {
+            continue;
+        }
+
+        const Node& n1 = nodes[from];
+        const Node& n2 = nodes[to];
+        double dist = GeoDistance::distance(n1.lat, n1.lon, n2.lat, n2.lon, GeoDistance::Fast);
+
+        upsertEdge(from, to, dist, way);
+        uses[EdgeKey(from, to)]++;
+        changed.insert(EdgeKey(from, to));
+        if (!way.oneWay) {
+            upsertEdge(to, from, dist, way);
+            uses[EdgeKey(to, from)]++;
+            changed.insert(EdgeKey(to, from));
+        }
+    }
+}
+
+// Re-measure every edge into or out of a node whose coordinates moved
+void Graph::remeasureNodeEdges(qint64 nodeId, QSet<EdgeKey>& changed)
+{
+    const Node& moved = nodes[nodeId];
+    auto remeasure = [&](qint64 from, qint64 to, qint64 other) {
+        Edge* edge = findMutableEdge(from, to);
+        auto node = nodes.constFind(other);
+        if (!edge || node == nodes.constEnd()) {
+            return;
+        }
+        edge->distance = GeoDistance::distance(moved.lat, moved.lon, node->lat, node->lon,
+                                               GeoDistance::Fast);
+        changed.insert(EdgeKey(from, to));
+    };
+
+    const QList<Edge> edges = adj.value(nodeId);
+    for (const Edge& edge : edges) {
+        remeasure(nodeId, edge.to, edge.to);
+    }
+    const QVector<qint64> tails = incoming.value(nodeId);
+    for (qint64 from : tails) {
+        remeasure(from, nodeId, from);
+    }
+}
+
+// Apply an OsmChange (.osc) file to the loaded graph. Nodes are never
+// removed, because running vehicles may still reference their ids: deleted
+// nodes and ways simply have their edges closed. The whole file is parsed
+// before anything is changed, so a malformed file leaves the graph as is.
+bool Graph::applyOsmChange(const QString& filePath, QList<EdgeKey>* changedEdges)
+{
+    QFile file(filePath);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        return false;
+    }
+
+    enum Action { None, Create, Modify, Delete };
+    struct Change {
+        Action action;
+        bool isWay;
+        bool isRoad;
+        Node node;
+        qint64 wayId;
+        Way way;
+    };
+    QVector<Change> changes;
+    Action action = None;
+
+    QXmlStreamReader xml(&file);
+    while (!xml.atEnd()) {
+        xml.readNext();
+
+        if (xml.isEndElement() && (xml.name() == QString("create") ||
+                                   xml.name() == QString("modify") ||
+                                   xml.name() == QString("delete"))) {
+            action = None;
+            continue;
+        }
+        if (!xml.isStartElement()) {
+            continue;
+        }
+
+        if (xml.name() == QString("create")) {
+            action = Create;
+        } else if (xml.name() == QString("modify")) {
+            action = Modify;
+        } else if (xml.name() == QString("delete")) {
+            action = Delete;
+        } else if (action != None && xml.name() == QString("node")) {
+            Change change{action, false, false, readNode(xml), 0, Way()};
+            changes.append(change);
+        } else if (action != None && xml.name() == QString("way")) {
+            Change change{action, true, false, Node(), 0, Way()};
+            change.isRoad = readWay(xml, change.wayId, change.way);
+            changes.append(change);
+        }
+    }
+
+    file.close();
+
+    if (xml.hasError()) {
+        return false;
+    }
+
+    bool nodesAdded = false;
+    QSet<EdgeKey> changed;
+    QHash<EdgeKey, int> uses = segmentUses();
+
+    for (const Change& change : changes) {
+        if (!change.isWay) {
+            const Node& node = change.node;
+
+            if (change.action == Delete) {
+                closeNodeEdges(node.id, changed);
+                continue;
+            }
+
+            auto existing = nodes.find(node.id);
+            if (existing == nodes.end()) {
+                insertNode(node);
+                nodesAdded = true;
+                continue;
+            }
+
+            bool moved = existing->lat != node.lat || existing->lon != node.lon;
+            existing->lat = node.lat;
+            existing->lon = node.lon;
+            existing->pos = node.pos;
+            if (node.nameId != StringPool::Empty) {
+                existing->nameId = node.nameId;
+            }
+            if (node.streetNameId != StringPool::Empty) {
+                existing->streetNameId = node.streetNameId;
+            }
+            if (moved) {
+                remeasureNodeEdges(node.id, changed);
+            }
+        } else {
+            // Whatever the action, the old geometry of the way goes away
+            auto existing = ways.find(change.wayId);
+            if (existing != ways.end()) {
+                closeWayEdges(existing.value(), uses, changed);
+                ways.erase(existing);
+            }
+
+            if (change.action != Delete && change.isRoad) {
+                openWayEdges(change.way, uses, changed);
+                assignStreetName(change.way);
+                ways.insert(change.wayId, change.way);
+            }
+        }
+    }
+
+    if (nodesAdded) {
+        generateDisplayNames();
+    }
+    if (!changed.isEmpty() || nodesAdded) {
+        revision++;
+    }
+    if (changedEdges) {
+        *changedEdges = changed.values();
+    }
+
+    return true;
+}
+
+// ----------------------------------------------------------------------
+// Isochrones
+// ----------------------------------------------------------------------
+
+Graph::Isochrone Graph::isochrone(qint64 source, double maxCost, RouteMetric metric,
+                                  bool withOutline) const
+{
+    return isochrone(QVector<qint64>{source}, maxCost, metric, withOutline);
+}
+
+Graph::Isochrone Graph::isochrone(const QVector<qint64>& sources, double maxCost,
+                                  RouteMetric metric, bool withOutline) const
+{
+    Isochrone result;
+
+    switch (metric) {
+    case FreeFlowTime:
+        boundedSearch<FreeFlowTimeMetric>(sources, maxCost, result);
+        break;
+    case TruckTime:
+        boundedSearch<TruckMetric>(sources, maxCost, result);
+        break;
+    default:
+        boundedSearch<DistanceMetric>(sources, maxCost, result);
+        break;
+    }
+
+    if (withOutline) {
+        QVector<QPointF> points;
+        points.reserve(result.nodes.size());
+        for (qint64 id : result.nodes) {
+            points.append(getNode(id).pos);
+        }
+        result.outline = convexHull(points);
+    }
 
     return result;
 }
+
+// Multi-source Dijkstra over the metric's CSR weights, pruned at maxCost
+template <typename Metric>
+void Graph::boundedSearch(const QVector<qint64>& sources, double maxCost, Isochrone& result) const
+{
+    RoutingTopology topology;
+    QVector<double> weights;
+    routingArrays<Metric>(topology, weights);
+    const int* offsets = topology.offsets.constData();
+    const int* targets = topology.targets.constData();
+    const double* weight = weights.constData();
+
+    SearchScratch& scratch = searchScratch;
+    scratch.prepare(denseIds.size());
+    double* dist = scratch.dist.data();
+
+    typedef std::pair<double, int> QueueEntry;
+    std::priority_queue<QueueEntry, std::vector<QueueEntry>, std::greater<QueueEntry>> queue;
+
+    for (qint64 source : sources) {
+        int index = nodeIndexOf(source);
+        if (index < 0 || dist[index] == 0.0) {
+            continue;
+        }
+        dist[index] = 0.0;
+        scratch.touched.append(index);
+        queue.push(QueueEntry(0.0, index));
+    }
+
+    while (!queue.empty()) {
+        QueueEntry top = queue.top();
+        queue.pop();
+
+        int current = top.second;
+        if (top.first > dist[current]) {
+            continue;  // stale entry
+        }
+
+        result.nodes.append(denseIds[current]);
+        result.costs.append(top.first);
+
+        for (int e = offsets[current]; e < offsets[current + 1]; ++e) {
+            int next = targets[e];
+            double newDist = top.first + weight[e];
+            if (newDist > maxCost || newDist >= dist[next]) {
+                continue;  // everything beyond the limit is pruned
+            }
+            if (dist[next] == IMPASSABLE) {
+                scratch.touched.append(next);
+            }
+            dist[next] = newDist;
+            queue.push(QueueEntry(newDist, next));
+        }
+    }
+
+    scratch.reset();
+}
+
+QVector<Graph::Isochrone> Graph::isochrones(const QVector<qint64>& origins, double maxCost,
+                                            RouteMetric metric, bool withOutline) const
+{
+    // Each worker thread reuses its own scratch space
+    return QtConcurrent::blockingMapped<QVector<Isochrone>>(
+        origins, [this, maxCost, metric, withOutline](qint64 origin) {
+            return isochrone(origin, maxCost, metric, withOutline);
+        });
+}
+
+// Andrew's monotone chain; returns the hull counter-clockwise
+QVector<QPointF> Graph::convexHull(QVector<QPointF> points)
+{
+    if (points.size() < 3) {
+        return points;
+    }
+
+    std::sort(points.begin(), points.end(), [](const QPointF& a, const QPointF& b) {
+        return a.x() < b.x() || (a.x() == b.x() && a.y() < b.y());
+    });
+
+    auto cross = [](const QPointF& o, const QPointF& a, const QPointF& b) {
+        return (a.x() - o.x()) * (b.y() - o.y()) - (a.y() - o.y()) * (b.x() - o.x());
+    };
+
+    QVector<QPointF> hull(2 * points.size());
+    int k = 0;
+
+    // Lower hull
+    for (int i = 0; i < points.size(); ++i) {
+        while (k >= 2 && cross(hull[k - 2], hull[k - 1], points[i]) <= 0) {
+            k--;
+        }
+        hull[k++] = points[i];
+    }
+
+    // Upper hull
+    for (int i = points.size() - 2, lower = k + 1; i >= 0; --i) {
+        while (k >= lower && cross(hull[k - 2], hull[k - 1], points[i]) <= 0) {
+            k--;
+        }
+        hull[k++] = points[i];
+    }
+
+    hull.resize(k - 1);
+    return hull;
+}
@@ -8,6 +8,15 @@
 #include <QString>
 #include <QPointF>
 #include <QVector>
+#include <QSet>
+#include <QHash>
+#include <QStringView>
+#include <QMutex>
+#include <array>
+#include <functional>
+#include "string_pool.h"
+
+class QXmlStreamReader;
 
 class Graph
 {
@@ -20,22 +29,65 @@ public:
         double lat;
         double lon;
         QPointF pos;
-        QString name;        // Location name (e.g., "Gulshan-e-Iqbal")
-        QString streetName;  // Street name if available
+        StringPool::Handle nameId;        // Location name (e.g., "Gulshan-e-Iqbal")
+        StringPool::Handle streetNameId;  // Street name if available
+
+        QStringView name() const { return StringPool::global().view(nameId); }
+        QStringView streetName() const { return StringPool::global().view(streetNameId); }
+    };
+
+    // Road classes from OSM highway=*, most important first
+    enum RoadClass : quint8 {
+        Motorway,
+        Trunk,
+        Primary,
+        Secondary,
+        Tertiary,
+        Residential,
+        Service,
+        OtherRoad
     };
 
     struct Edge {
         qint64 to;
         double distance;
+        double congestion;   // travel-time multiplier, 1.0 = free flow
+        bool closed;         // closed edges are skipped by routing
+        RoadClass roadClass;
+        bool truckAllowed;   // false for hgv=no
+        float speedLimit;    // km/h, the class default when untagged
+    };
+
+    // Road way as read from OSM, kept so change files can patch it
+    struct Way {
+        QVector<qint64> nodeIds;
+        StringPool::Handle nameId = StringPool::Empty;
+        StringPool::Handle roadTypeId = StringPool::Empty;  // OSM highway=* value
+        float maxSpeed = 0.0f;                              // km/h, 0 if untagged
+        bool truckAllowed = true;
+        bool oneWay = false;                                // edges only run along nodeIds
+
+        QStringView name() const { return StringPool::global().view(nameId); }
+        QStringView roadType() const { return StringPool::global().view(roadTypeId); }
     };
 
+    typedef QPair<qint64, qint64> EdgeKey;  // (from, to)
+
     struct PathResult {
         bool found;
         QVector<qint64> path;
         double totalDistance;
+        double totalCost;     // metric cost weighted by congestion
         QString errorMessage;
     };
 
+    // Result of a bounded one-to-all search, nodes in order of cost
+    struct Isochrone {
+        QVector<qint64> nodes;
+        QVector<double> costs;       // metric cost from the nearest source, parallel to nodes
+        QVector<QPointF> outline;    // convex hull of reached nodes (lon, lat), if requested
+    };
+
     struct NamedLocation {
         qint64 nodeId;
         QString displayName;  // "Gulshan-e-Iqbal (24.8600, 67.0100)"
@@ -43,39 +95,166 @@ public:
         double lon;
     };
 
-    // Map parsing
-    bool loadFromOSM(const QString& filePath);
+    // Map parsing. The optional callback receives bytes parsed so far and
+    // the total; returning false cancels the load and leaves the graph empty.
+    typedef std::function<bool(qint64 bytesRead, qint64 totalBytes)> LoadProgress;
+    bool loadFromOSM(const QString& filePath, const LoadProgress& progress = LoadProgress());
+    void addNode(qint64 id, double lat, double lon,
+                 const QString& name = QString(), const QString& streetName = QString());
 
     // Graph queries
     int getNodeCount() const { return nodes.size(); }
-    int getEdgeCount() const;
+    int getEdgeCount() const;   // road segments: node pairs joined in either direction
     bool hasNode(qint64 id) const { return nodes.contains(id); }
-    Node getNode(qint64 id) const { return nodes.value(id); }
+    const Node& getNode(qint64 id) const;  // a zeroed node if id is unknown
     const QMap<qint64, Node>& getNodes() const { return nodes; }
     QList<Edge> getEdges(qint64 nodeId) const { return adj.value(nodeId); }
+    const Edge* findEdge(qint64 from, qint64 to) const;
     QList<qint64> getAllNodeIds() const { return nodes.keys(); }
 
+    // Dense 0..N-1 numbering of nodes, assigned in insertion order and
+    // stable until clear()
+    int nodeIndexOf(qint64 id) const { return denseIndex.value(id, -1); }
+    qint64 nodeIdAt(int index) const { return denseIds[index]; }
+
     // Location name queries
     QList<NamedLocation> getNamedLocations() const;
     qint64 findNodeByName(const QString& name) const;
     QString getNodeDisplayName(qint64 nodeId) const;
 
-    // Pathfinding
-    PathResult dijkstra(qint64 source, qint64 destination);
+    // Pathfinding. Each metric has its own search kernel over weight
+    // arrays that are built on first use and rebuilt after the graph or
+    // the congestion factors change. Costs are km for ShortestDistance and
+    // minutes for the time-based metrics.
+    enum RouteMetric {
+        ShortestDistance,
+        FreeFlowTime,
+        TruckTime,         // avoids hgv=no roads, capped speed, penalised minor roads
+        RouteMetricCount
+    };
+    PathResult dijkstra(qint64 source, qint64 destination,
+                        RouteMetric metric = ShortestDistance) const;
+
+    // Connectivity over open edges, computed after a load and again after
+    // the graph changes. mayReach() is O(1) and only rules pairs out: false
+    // means no path exists; true means one exists if both nodes share a
+    // strongly connected component, and a search has to tell otherwise.
+    bool mayReach(qint64 from, qint64 to) const;
+    int componentOf(qint64 id) const;          // strongly connected component, -1 if unknown
+    QVector<qint64> largestComponent() const;  // node ids of the largest SCC
+
+    static RoadClass roadClassOf(QStringView highway);
+    static float defaultSpeed(RoadClass roadClass);     // km/h
+    static float parseMaxSpeed(QStringView value);      // km/h, 0 if not numeric
+
+    // Reachability: everything within maxCost of the source(s) under the
+    // same weights dijkstra() uses for the metric, i.e. congestion-weighted
+    // km for ShortestDistance and congestion-weighted minutes for the time
+    // metrics. A multi-source query measures each node from its nearest
+    // source; isochrones() runs one independent query per origin in parallel.
+    Isochrone isochrone(qint64 source, double maxCost, RouteMetric metric = ShortestDistance,
+                        bool withOutline = false) const;
+    Isochrone isochrone(const QVector<qint64>& sources, double maxCost,
+                        RouteMetric metric = ShortestDistance, bool withOutline = false) const;
+    QVector<Isochrone> isochrones(const QVector<qint64>& origins, double maxCost,
+                                  RouteMetric metric = ShortestDistance,
+                                  bool withOutline = false) const;
+
+    // Live congestion: edge cost becomes distance * congestion
+    bool setEdgeCongestion(qint64 from, qint64 to, double factor);
+    void resetCongestion();
+
+    // Incremental network updates. Node ids stay valid; closed edges are
+    // kept in place so they can be reopened. revision() changes whenever
+    // the topology or a distance changes, so dependent caches can tell
+    // they are stale.
+    bool closeEdge(qint64 from, qint64 to);
+    bool reopenEdge(qint64 from, qint64 to);
+    bool setEdgeDistance(qint64 from, qint64 to, double distance);
+    bool applyOsmChange(const QString& filePath, QList<EdgeKey>* changedEdges = nullptr);
+    quint64 getRevision() const { return revision; }
+
+    // Hash of the dense node numbering; state that stores dense indices
+    // (e.g. simulator checkpoints) is only valid for a graph with the same
+    // hash. Kept up to date as nodes are added, so reading it is O(1).
+    quint64 layoutHash() const { return layoutHashValue; }
 
     // Clear graph
     void clear();
 
+    // Exchange contents with another graph, e.g. one loaded in the background
+    void swap(Graph& other);
+
 public:
     QMap<qint64, Node> nodes;
-    QMap<qint64, QList<Edge>> adj;
+    QMap<qint64, QList<Edge>> adj;       // at most one edge per directed segment
+    QHash<qint64, QVector<qint64>> incoming;  // node ID → tails of its in-edges
     QMap<QString, qint64> nameToNodeId;  // Location name → node ID
+    QMap<qint64, Way> ways;              // road ways by OSM id
+    QHash<qint64, int> denseIndex;       // node ID → dense index
+    QVector<qint64> denseIds;            // dense index → node ID
+    quint64 revision;
 
     // Helper functions
-    double haversineDistance(double lat1, double lon1, double lat2, double lon2);
-    void addEdge(qint64 from, qint64 to, double distance);
+    static double haversineDistance(double lat1, double lon1, double lat2, double lon2);
+    void addEdge(qint64 from, qint64 to, double distance,
+                 RoadClass roadClass = OtherRoad, float speedLimit = 0.0f, bool truckAllowed = true);
     QString generateNodeName(const Node& node, int index) const;
     void generateDisplayNames();
+
+private:
+    // Routing arrays: adjacency in CSR form by dense index, plus one weight
+    // array per metric. Readers take implicitly shared copies under the
+    // lock, so a rebuild never pulls data out from under a running search.
+    struct RoutingTopology {
+        quint64 revision = ~quint64(0);
+        QVector<int> offsets;    // dense index -> first edge, N + 1 entries
+        QVector<int> targets;    // dense index of each edge's head
+    };
+    struct MetricWeights {
+        quint64 revision = ~quint64(0);
+        quint64 congestionStamp = ~quint64(0);
+        QVector<double> weights; // parallel to RoutingTopology::targets, inf = impassable
+    };
+    struct ComponentLabels {
+        quint64 revision = ~quint64(0);
+        QVector<int> strong;     // dense index -> SCC label
+        QVector<int> weak;       // dense index -> weakly connected component label
+        int largest = -1;        // label of the largest SCC
+    };
+    mutable QMutex routingLock;
+    mutable RoutingTopology routingTopology;
+    mutable std::array<MetricWeights, RouteMetricCount> metricWeights;
+    mutable ComponentLabels componentLabels;
+    quint64 congestionStamp;
+    quint64 layoutHashValue;
+
+    static quint64 extendLayoutHash(quint64 hash, qint64 id);
+
+    template <typename Metric>
+    PathResult shortestPath(qint64 source, qint64 destination) const;
+    template <typename Metric>
+    void boundedSearch(const QVector<qint64>& sources, double maxCost, Isochrone& result) const;
+    template <typename Metric>
+    void routingArrays(RoutingTopology& topology, QVector<double>& weights) const;
+    void rebuildRoutingTopology() const;
+    void rebuildComponents() const;
+    ComponentLabels components() const;
+    template <typename Visit>
+    void forEachRoutingEdge(Visit visit) const;
+
+    void insertNode(const Node& node);
+    static Node readNode(QXmlStreamReader& xml);
+    static bool readWay(QXmlStreamReader& xml, qint64& wayId, Way& way);
+    void assignStreetName(const Way& way);
+    Edge* findMutableEdge(qint64 from, qint64 to);
+    void upsertEdge(qint64 from, qint64 to, double distance, const Way& way);
+    void closeNodeEdges(qint64 nodeId, QSet<EdgeKey>& changed);
+    QHash<EdgeKey, int> segmentUses() const;
+    void closeWayEdges(const Way& way, QHash<EdgeKey, int>& uses, QSet<EdgeKey>& changed);
+    void openWayEdges(const Way& way, QHash<EdgeKey, int>& uses, QSet<EdgeKey>& changed);
+    static QVector<QPointF> convexHull(QVector<QPointF> points);
+    void remeasureNodeEdges(qint64 nodeId, QSet<EdgeKey>& changed);
 };
 
 #endif // GRAPH_H
@@ -0,0 +1,81 @@
+#include "graph_partition.h"
+#include <algorithm>
+
+GraphPartition GraphPartition::bisect(const Graph& graph, int regionCount)
+{
+    GraphPartition partition;
+    partition.graph = &graph;
+    partition.regions = qMax(1, regionCount);
+
+    int nodeCount = graph.denseIds.size();
+    partition.regionByIndex.fill(0, nodeCount);
+    partition.sizes.fill(0, partition.regions);
+
+    QVector<int> indices(nodeCount);
+    for (int i = 0; i < nodeCount; ++i) {
+        indices[i] = i;
+    }
+    partition.split(indices, 0, nodeCount, 0, partition.regions);
+
+    for (int region : partition.regionByIndex) {
+        partition.sizes[region]++;
+    }
+
+    // Directed edges whose endpoints fall into different regions
+    for (auto it = graph.adj.cbegin(); it != graph.adj.cend(); ++it) {
+        int from = partition.regionOf(it.key());
+        for (const Graph::Edge& edge : it.value()) {
+            if (partition.regionOf(edge.to) != from) {
+                partition.cutEdges++;
+            }
+        }
+    }
+
+    return partition;
+}
+
+void GraphPartition::split(QVector<int>& indices, int begin, int end, int firstRegion, int count)
+{
+    if (count == 1 || end - begin <= 1) {
+        for (int i = begin; i < end; ++i) {
+            regionByIndex[indices[i]] = firstRegion;
+        }
+        return;
+    }
+
+    // Cut across the longer side of the bounding box
+    double minLon = 180.0, maxLon = -180.0, minLat = 90.0, maxLat = -90.0;
+    for (int i = begin; i < end; ++i) {
+        const Graph::Node& node = graph->getNode(graph->nodeIdAt(indices[i]));
+        minLon = qMin(minLon, node.lon);
+        maxLon = qMax(maxLon, node.lon);
+        minLat = qMin(minLat, node.lat);
+        maxLat = qMax(maxLat, node.lat);
+    }
+    bool byLon = (maxLon - minLon) >= (maxLat - minLat);
+
+    int leftCount = count / 2;
+    int mid = begin + int(qint64(end - begin) * leftCount / count);
+
+    // Ties are broken by dense index so the cut is deterministic
+    std::nth_element(indices.begin() + begin, indices.begin() + mid, indices.begin() + end,
+                     [this, byLon](int a, int b) {
+                         const Graph::Node& na = graph->getNode(graph->nodeIdAt(a));
+                         const Graph::Node& nb = graph->getNode(graph->nodeIdAt(b));
+                         double ka = byLon ? na.lon : na.lat;
+                         double kb = byLon ? nb.lon : nb.lat;
+                         return ka < kb || (ka == kb && a < b);
+                     });
+
+    split(indices, begin, mid, firstRegion, leftCount);
+    split(indices, mid, end, firstRegion + leftCount, count - leftCount);
+}
+
+int GraphPartition::regionOf(qint64 nodeId) const
+{
+    if (!graph) {
+        return -1;
+    }
+    int index = graph->nodeIndexOf(nodeId);
+    return index < 0 || index >= regionByIndex.size() ? -1 : regionByIndex[index];
+}
@@ -0,0 +1,36 @@
+#ifndef GRAPH_PARTITION_H
+#define GRAPH_PARTITION_H
+
+#include <QtGlobal>
+#include <QVector>
+#include "graph.h"
+
+// Splits a graph into balanced geographic regions by recursive coordinate
+// bisection: the node set is cut at the median of its longer axis, with
+// the cut placed so that each side gets node counts proportional to the
+// number of regions it will hold. The result depends only on the graph,
+// so every shard process computes the same partition independently.
+class GraphPartition
+{
+public:
+    GraphPartition() : regions(0) {}
+
+    static GraphPartition bisect(const Graph& graph, int regionCount);
+
+    int regionCount() const { return regions; }
+    int regionOf(qint64 nodeId) const;       // -1 for unknown nodes
+    int regionOfIndex(int denseIndex) const { return regionByIndex[denseIndex]; }
+    int nodeCount(int region) const { return sizes.value(region); }
+    int cutEdgeCount() const { return cutEdges; }
+
+private:
+    const Graph* graph = nullptr;
+    int regions;
+    QVector<int> regionByIndex;   // dense node index -> region
+    QVector<int> sizes;
+    int cutEdges = 0;
+
+    void split(QVector<int>& indices, int begin, int end, int firstRegion, int count);
+};
+
+#endif // GRAPH_PARTITION_H
@@ -0,0 +1,57 @@
+#include "location_list_model.h"
+
+LocationListModel::LocationListModel(QObject* parent)
+    : QAbstractListModel(parent)
+    , fetched(0)
+{
+}
+
+void LocationListModel::setLocations(const QList<Graph::NamedLocation>& newLocations)
+{
+    beginResetModel();
+    locations = newLocations;
+    fetched = 0;
+    endResetModel();
+}
+
+int LocationListModel::rowCount(const QModelIndex& parent) const
+{
+    return parent.isValid() ? 0 : fetched;
+}
+
+QVariant LocationListModel::data(const QModelIndex& index, int role) const
+{
+    if (!index.isValid() || index.row() >= fetched) {
+        return QVariant();
+    }
+
+    const Graph::NamedLocation& loc = locations[index.row()];
+    if (role == Qt::DisplayRole) {
+        return loc.displayName;
+    }
+    if (role == Qt::UserRole) {
+        return QVariant::fromValue(loc.nodeId);
+    }
+    return QVariant();
+}
+
+bool LocationListModel::canFetchMore(const QModelIndex& parent) const
+{
+    return !parent.isValid() && fetched < locations.size();
+}
+
+void LocationListModel::fetchMore(const QModelIndex& parent)
+{
+    if (parent.isValid()) {
+        return;
+    }
+
+    int count = qMin(BatchSize, int(locations.size()) - fetched);
+    if (count <= 0) {
+        return;
+    }
+
+    beginInsertRows(QModelIndex(), fetched, fetched + count - 1);
+    fetched += count;
+    endInsertRows();
+}
@@ -0,0 +1,34 @@
+#ifndef LOCATION_LIST_MODEL_H
+#define LOCATION_LIST_MODEL_H
+
+#include <QAbstractListModel>
+#include "graph.h"
+
+// List of named locations for the source/destination combo boxes.
+// Rows are exposed to views in batches through canFetchMore()/fetchMore(),
+// so attaching a city-sized list costs nothing up front.
+// Qt::DisplayRole is the display name, Qt::UserRole the node ID.
+class LocationListModel : public QAbstractListModel
+{
+    Q_OBJECT
+
+public:
+    explicit LocationListModel(QObject* parent = nullptr);
+
+    void setLocations(const QList<Graph::NamedLocation>& locations);
+
+    int rowCount(const QModelIndex& parent = QModelIndex()) const override;
+    QVariant data(const QModelIndex& index, int role = Qt::DisplayRole) const override;
+
+protected:
+    bool canFetchMore(const QModelIndex& parent) const override;
+    void fetchMore(const QModelIndex& parent) override;
+
+private:
+    static const int BatchSize = 500;
+
+    QList<Graph::NamedLocation> locations;
+    int fetched;
+};
+
+#endif // LOCATION_LIST_MODEL_H
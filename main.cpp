@@ -1,13 +1,89 @@
 #include <QCoreApplication>
+#include <QApplication>
 #include <QTimer>
 #include <QDebug>
+#include <QCommandLineParser>
+#include <QProcess>
 #include "graph.h"
+#include "graph_partition.h"
 #include "traffic_simulator.h"
+#include "shard_link.h"
+#include "route_server.h"
+#include "demand_model.h"
+#include "geo_distance.h"
+#include "mainwindow.h"
 
 int main(int argc, char *argv[])
 {
+    // The map window needs a QApplication; every other mode runs headless
+    for (int i = 1; i < argc; ++i) {
+        if (qstrcmp(argv[i], "--gui") == 0) {
+            QApplication app(argc, argv);
+            MainWindow window;
+            window.show();
+            return app.exec();
+        }
+    }
+
     QCoreApplication app(argc, argv);
 
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    QCommandLineOption metricsFileOption("metrics-file",
+                                         "Periodically write simulator metrics to <path>.", "path");
+    QCommandLineOption metricsFormatOption("metrics-format",
+                                           "Metrics file format: prometheus or json.", "format",
+                                           "prometheus");
+    QCommandLineOption guiOption("gui", "Open the map window instead of running headless.");
+    QCommandLineOption checkpointOption("checkpoint",
+                                        "Write a simulator checkpoint to <path> every minute.", "path");
+    QCommandLineOption restoreOption("restore",
+                                     "Warm start from the checkpoint at <path>.", "path");
+    QCommandLineOption demandOption("demand",
+                                    "Spawn vehicles from the OD trip table at <path>.", "path");
+    QCommandLineOption zonesOption("zones",
+                                   "Zone table for --demand, mapping zones to nodes.", "path");
+    QCommandLineOption spawnRateOption("spawn-rate",
+                                       "Random trips per simulated hour without --demand.", "trips",
+                                       "720");
+    QCommandLineOption catchUpOption("max-catch-up",
+                                     "Fixed steps a late frame may run before dropping time.", "steps",
+                                     "4");
+    QCommandLineOption serveOption("serve",
+                                   "Answer route queries on local socket <name> instead of simulating.",
+                                   "name");
+    QCommandLineOption shardsOption("shards",
+                                    "Split the map into <n> regions and simulate each in its own process.",
+                                    "n");
+    QCommandLineOption shardWorkerOption("shard-worker",
+                                         "Internal: run as the worker for region <index>.", "index");
+    QCommandLineOption shardCountOption("shard-count",
+                                        "Internal: number of regions of the sharded run.", "n", "1");
+    QCommandLineOption shardServerOption("shard-server",
+                                         "Internal: local socket name of the shard coordinator.", "name");
+    parser.addOption(guiOption);
+    parser.addOption(metricsFileOption);
+    parser.addOption(metricsFormatOption);
+    parser.addOption(checkpointOption);
+    parser.addOption(restoreOption);
+    parser.addOption(demandOption);
+    parser.addOption(zonesOption);
+    parser.addOption(spawnRateOption);
+    parser.addOption(catchUpOption);
+    parser.addOption(serveOption);
+    parser.addOption(shardsOption);
+    parser.addOption(shardWorkerOption);
+    parser.addOption(shardCountOption);
+    parser.addOption(shardServerOption);
+    parser.process(app);
+
+    // Edge lengths come from the vectorised distance kernel; make sure this
+    // build's lanes are within their documented error bounds
+    const char* failedLanes = nullptr;
+    if (!GeoDistance::checkAccuracy(&failedLanes)) {
+        qWarning() << "Distance kernel" << failedLanes << "exceeds its error bounds";
+    }
+
     // -----------------------------
     // 1️⃣ Load or create map
     // -----------------------------
@@ -20,30 +96,143 @@ int main(int argc, char *argv[])
         qWarning() << "Could not load OSM file — creating small test map.";
 
         // Create a few test nodes manually (Karachi coordinates)
-        Graph::Node n1{1, 24.8607, 67.0011, QPointF(67.0011, 24.8607), "Start", "Road A"};
-        Graph::Node n2{2, 24.8610, 67.0020, QPointF(67.0020, 24.8610), "Middle", "Road B"};
-        Graph::Node n3{3, 24.8613, 67.0030, QPointF(67.0030, 24.8613), "End", "Road C"};
+        graph.addNode(1, 24.8607, 67.0011, "Start", "Road A");
+        graph.addNode(2, 24.8610, 67.0020, "Middle", "Road B");
+        graph.addNode(3, 24.8613, 67.0030, "End", "Road C");
 
-        graph.nodes[n1.id] = n1;
-        graph.nodes[n2.id] = n2;
-        graph.nodes[n3.id] = n3;
+        const Graph::Node& n1 = graph.getNode(1);
+        const Graph::Node& n2 = graph.getNode(2);
+        const Graph::Node& n3 = graph.getNode(3);
 
         double d1 = graph.haversineDistance(n1.lat, n1.lon, n2.lat, n2.lon);
         double d2 = graph.haversineDistance(n2.lat, n2.lon, n3.lat, n3.lon);
 
         graph.addEdge(n1.id, n2.id, d1);
+        graph.addEdge(n2.id, n1.id, d1);
         graph.addEdge(n2.id, n3.id, d2);
+        graph.addEdge(n3.id, n2.id, d2);
 
         qDebug() << "Created test graph with" << graph.getNodeCount() << "nodes.";
     } else {
         qDebug() << "Loaded OSM graph with" << graph.getNodeCount() << "nodes.";
     }
 
+    // -----------------------------
+    // Headless query server: keep the map resident and answer clients
+    // -----------------------------
+    if (parser.isSet(serveOption)) {
+        RouteServer server(&graph);
+        if (!server.listen(parser.value(serveOption)))
+            return 1;
+        qDebug() << "Serving route queries on" << parser.value(serveOption);
+
+        QTimer report;
+        QObject::connect(&report, &QTimer::timeout, [&server]() {
+            for (int t = 0; t < RouteServer::QueryTypeCount; ++t) {
+                const LatencyHistogram& h = server.latency(RouteServer::QueryType(t));
+                if (h.count() == 0) continue;
+                qDebug() << RouteServer::queryName(RouteServer::QueryType(t))
+                         << "count:" << h.count()
+                         << "p50/p99/max (us):" << h.percentile(50.0) << h.percentile(99.0) << h.max();
+            }
+        });
+        report.start(10000);
+        return app.exec();
+    }
+
+    // -----------------------------
+    // Sharded run: this process only coordinates, one worker per region
+    // -----------------------------
+    if (parser.isSet(shardsOption)) {
+        int shardCount = parser.value(shardsOption).toInt();
+        if (shardCount < 2) {
+            qWarning() << "--shards needs at least 2 regions";
+            return 1;
+        }
+
+        GraphPartition partition = GraphPartition::bisect(graph, shardCount);
+        qDebug() << "Partitioned map into" << shardCount << "regions with"
+                 << partition.cutEdgeCount() << "boundary edges";
+
+        QString serverName = QString("traffic-dsa-%1").arg(QCoreApplication::applicationPid());
+        ShardCoordinator coordinator(&partition);
+        if (!coordinator.listen(serverName))
+            return 1;
+
+        // Workers get the same demand and scheduling options, so they all
+        // draw the same departure stream; files they write or read are
+        // suffixed per shard
+        QStringList shared;
+        for (const QCommandLineOption* option : { &demandOption, &zonesOption, &spawnRateOption,
+                                                  &catchUpOption, &metricsFormatOption }) {
+            if (parser.isSet(*option))
+                shared << "--" + option->names().first() << parser.value(*option);
+        }
+
+        for (int i = 0; i < shardCount; ++i) {
+            QStringList arguments = shared;
+            arguments << "--shard-worker" << QString::number(i)
+                      << "--shard-count" << QString::number(shardCount)
+                      << "--shard-server" << serverName;
+            for (const QCommandLineOption* option : { &metricsFileOption, &checkpointOption,
+                                                      &restoreOption }) {
+                if (parser.isSet(*option))
+                    arguments << "--" + option->names().first()
+                              << parser.value(*option) + QString(".shard%1").arg(i);
+            }
+
+            QProcess* worker = new QProcess(&app);
+            worker->setProcessChannelMode(QProcess::ForwardedChannels);
+            worker->start(QCoreApplication::applicationFilePath(), arguments);
+        }
+
+        QObject::connect(&coordinator, &ShardCoordinator::shardLost, &app, [&app]() {
+            app.exit(1);
+        });
+        QObject::connect(&coordinator, &ShardCoordinator::stepCompleted,
+                         [&coordinator](quint64 step, int handoffs, qint64 vehicles) {
+                             if (step % 200 != 0) return;
+                             qDebug() << "Step" << step << "vehicles:" << vehicles
+                                      << "handoffs:" << handoffs
+                                      << "barrier p99 (us):" << coordinator.barrierLatency().percentile(99.0)
+                                      << "stalled ticks:" << coordinator.stalledTicks();
+                         });
+        return app.exec();
+    }
+
+    // Worker of a sharded run: same partition, computed independently
+    bool sharded = parser.isSet(shardWorkerOption);
+    int shardRegion = parser.value(shardWorkerOption).toInt();
+    GraphPartition partition;
+    if (sharded) {
+        partition = GraphPartition::bisect(graph, parser.value(shardCountOption).toInt());
+    }
+
     // -----------------------------
     // 2️⃣ Create Traffic Simulator
     // -----------------------------
     TrafficSimulator simulator(&graph);
-    simulator.start();
+    if (parser.isSet(metricsFileOption)) {
+        SimulationMetrics::Format format = parser.value(metricsFormatOption) == "json"
+                                               ? SimulationMetrics::Json
+                                               : SimulationMetrics::Prometheus;
+        simulator.setMetricsEnabled(true);
+        simulator.setMetricsExport(parser.value(metricsFileOption), format);
+    }
+    if (parser.isSet(checkpointOption)) {
+        simulator.setAutoCheckpoint(parser.value(checkpointOption), 60000);
+    }
+    simulator.setMaxCatchUpSteps(parser.value(catchUpOption).toInt());
+
+    // Workers are stepped by the coordinator instead of their own timer
+    ShardWorker shardWorker(&simulator, shardRegion);
+    if (sharded) {
+        simulator.setRegion(&partition, shardRegion);
+        QObject::connect(&shardWorker, &ShardWorker::disconnected, &app, &QCoreApplication::quit);
+        shardWorker.connectTo(parser.value(shardServerOption));
+    } else {
+        simulator.start();
+    }
 
     // -----------------------------
     // 3️⃣ Connect signals
@@ -51,6 +240,7 @@ int main(int argc, char *argv[])
     QObject::connect(&simulator, &TrafficSimulator::vehiclesUpdated,
                      [](const QVector<Vehicle>& vehicles) {
                          for (const auto &v : vehicles) {
+                             if (!v.active) continue;
                              qDebug() << "🚗 Vehicle" << v.id
                                       << "pos:" << v.position
                                       << "progress:" << v.progress
@@ -66,22 +256,37 @@ int main(int argc, char *argv[])
                          }
                      });
 
+    QObject::connect(&simulator, &TrafficSimulator::frameOverrun,
+                     [](qint64 frameMicros, double droppedSeconds) {
+                         if (droppedSeconds > 0.0)
+                             qWarning() << "Frame took" << frameMicros << "us, dropped"
+                                        << droppedSeconds << "s of simulated time";
+                         else
+                             qWarning() << "Frame took" << frameMicros << "us";
+                     });
+
     // -----------------------------
-    // 4️⃣ Spawn vehicles periodically
+    // 4️⃣ Spawn vehicles from travel demand
     // -----------------------------
-    QTimer spawner;
-    QObject::connect(&spawner, &QTimer::timeout, [&]() {
-        auto nodeIds = graph.getAllNodeIds();
-        if (nodeIds.size() < 2) return;
-
-        qint64 src = nodeIds[QRandomGenerator::global()->bounded(nodeIds.size())];
-        qint64 dst = nodeIds[QRandomGenerator::global()->bounded(nodeIds.size())];
-        if (src == dst) return;
-
-        simulator.addVehicle(src, dst);
-        qDebug() << "Added vehicle from" << src << "to" << dst;
-    });
-    spawner.start(5000); // spawn every 5 seconds
+    // Every shard draws the same departure stream (the coordinator passes
+    // its demand options on to the workers) and keeps the trips that start
+    // in its own region
+    DemandModel demand(&graph);
+    if (parser.isSet(demandOption)) {
+        bool ok = (!parser.isSet(zonesOption) || demand.loadZones(parser.value(zonesOption)))
+                  && demand.loadTrips(parser.value(demandOption));
+        if (!ok)
+            return 1;
+        qDebug() << "Loaded demand," << demand.tripsPerHourAt(0.0) << "trips/h at start";
+    } else {
+        demand.setUniform(parser.value(spawnRateOption).toDouble());
+    }
+    simulator.setDemand(&demand);
+
+    // Restored after the demand model is set, so its clock resumes too
+    if (parser.isSet(restoreOption)) {
+        simulator.restoreCheckpoint(parser.value(restoreOption));
+    }
 
     // -----------------------------
     // 5️⃣ Run application loop
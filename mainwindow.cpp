@@ -1,35 +1,82 @@
 #include "mainwindow.h"
 #include "ui_mainwindow.h"
+#include "location_list_model.h"
+#include "map_view.h"
+#include "traffic_simulator.h"
+#include "demand_model.h"
 #include <QMessageBox>
 #include <QFileDialog>
+#include <QProgressDialog>
+#include <QtConcurrent>
 #include <QDir>
+#include <QLabel>
+
+namespace {
+const double SPAWN_RATE = 720.0;        // random trips per simulated hour
+const double FRAME_BUDGET_MS = 1000.0 / 60.0;
+}
 
 MainWindow::MainWindow(QWidget *parent)
     : QMainWindow(parent)
     , ui(new Ui::MainWindow)
     , mapLoaded(false)
+    , locationModel(new LocationListModel(this))
+    , mapView(nullptr)
+    , progressDialog(nullptr)
+    , simulator(new TrafficSimulator(&graph, this))
+    , frameStatsLabel(new QLabel(this))
 {
     ui->setupUi(this);
 
+    // The map takes all remaining space below the controls
+    mapView = new MapView(this);
+    ui->verticalLayout->addWidget(mapView, 1);
+
+    // Both combo boxes share one lazily populated model
+    ui->sourceCombo->setModel(locationModel);
+    ui->destCombo->setModel(locationModel);
+
     // Connect buttons
     connect(ui->loadMapButton, &QPushButton::clicked, this, &MainWindow::onLoadMapClicked);
     connect(ui->findPathButton, &QPushButton::clicked, this, &MainWindow::onFindPathClicked);
+    connect(&loadWatcher, &QFutureWatcher<MapLoadResult>::finished,
+            this, &MainWindow::onMapLoadFinished);
+    connect(ui->simulateButton, &QPushButton::toggled, this, &MainWindow::onSimulateToggled);
+
+    // Every simulation frame redraws vehicles and lights
+    connect(simulator, &TrafficSimulator::vehiclesUpdated, mapView, &MapView::setVehicles);
+    connect(simulator, &TrafficSimulator::trafficLightsUpdated,
+            mapView, &MapView::setTrafficLights);
+
+    // Once a second, report the vehicle count and paint time against 60 fps
+    statusBar()->addPermanentWidget(frameStatsLabel);
+    statsTimer.setInterval(1000);
+    connect(&statsTimer, &QTimer::timeout, this, &MainWindow::updateFrameStats);
 
     // Disable pathfinding UI until map is loaded
     ui->sourceCombo->setEnabled(false);
     ui->destCombo->setEnabled(false);
     ui->findPathButton->setEnabled(false);
+    ui->simulateButton->setEnabled(false);
 
     setWindowTitle("Traffic Control Simulator - Map & Graph Module");
 }
 
 MainWindow::~MainWindow()
 {
+    simulator->stop();
+    simulator->setDemand(nullptr);
+    loadWatcher.cancel();
+    loadWatcher.waitForFinished();
     delete ui;
 }
 
 void MainWindow::onLoadMapClicked()
 {
+    if (loadWatcher.isRunning()) {
+        return;
+    }
+
     QString filePath = QFileDialog::getOpenFileName(
         this,
         "Select OpenStreetMap File",
@@ -41,40 +88,106 @@ void MainWindow::onLoadMapClicked()
         return;
     }
 
-    QMessageBox::information(this, "Loading", "Parsing map data, please wait...");
+    ui->loadMapButton->setEnabled(false);
 
-    bool success = graph.loadFromOSM(filePath);
+    // Non-modal: the current map stays usable while the new one parses
+    progressDialog = new QProgressDialog("Parsing map data...", "Cancel", 0, 1000, this);
+    progressDialog->setWindowModality(Qt::NonModal);
+    progressDialog->setAttribute(Qt::WA_DeleteOnClose);
+    progressDialog->setMinimumDuration(0);
+    connect(progressDialog, &QProgressDialog::canceled,
+            &loadWatcher, &QFutureWatcher<MapLoadResult>::cancel);
+    connect(&loadWatcher, &QFutureWatcher<MapLoadResult>::progressValueChanged,
+            progressDialog, &QProgressDialog::setValue);
+    connect(&loadWatcher, &QFutureWatcher<MapLoadResult>::progressTextChanged,
+            progressDialog, &QProgressDialog::setLabelText);
 
-    if (success) {
-        mapLoaded = true;
+    loadWatcher.setFuture(QtConcurrent::run(&MainWindow::loadMap, filePath));
+}
 
-        // Populate combo boxes with location names
-        ui->sourceCombo->clear();
-        ui->destCombo->clear();
+// Runs on a worker thread: parse into a fresh graph and prepare the sorted
+// location list, so the GUI thread only has to swap the results in
+void MainWindow::loadMap(QPromise<MapLoadResult>& promise, const QString& filePath)
+{
+    promise.setProgressRange(0, 1000);
 
-        QList<Graph::NamedLocation> locations = graph.getNamedLocations();
+    MapLoadResult result;
+    result.graph = QSharedPointer<Graph>::create();
 
-        for (const Graph::NamedLocation& loc : locations) {
-            ui->sourceCombo->addItem(loc.displayName, QVariant::fromValue(loc.nodeId));
-            ui->destCombo->addItem(loc.displayName, QVariant::fromValue(loc.nodeId));
+    result.success = result.graph->loadFromOSM(filePath, [&promise](qint64 done, qint64 total) {
+        if (total > 0) {
+            promise.setProgressValueAndText(
+                int(done * 1000 / total),
+                QString("Parsed %1 of %2 MB")
+                    .arg(done / 2 / 1048576.0, 0, 'f', 1)
+                    .arg(total / 2 / 1048576.0, 0, 'f', 1));
         }
+        return !promise.isCanceled();
+    });
+
+    if (promise.isCanceled()) {
+        return;
+    }
+
+    if (result.success) {
+        result.locations = result.graph->getNamedLocations();
+    }
+    promise.addResult(result);
+}
 
-        // Enable pathfinding UI
-        ui->sourceCombo->setEnabled(true);
-        ui->destCombo->setEnabled(true);
-        ui->findPathButton->setEnabled(true);
+void MainWindow::onMapLoadFinished()
+{
+    ui->loadMapButton->setEnabled(true);
 
-        QString message = QString(
-                              "✅ Map loaded successfully!\n\n"
-                              "Nodes: %1\n"
-                              "Edges: %2\n\n"
-                              "Select locations from dropdowns to find routes!"
-                              ).arg(graph.getNodeCount()).arg(graph.getEdgeCount());
+    // Closing the dialog emits canceled(), which must not reach the
+    // watcher once the load has finished
+    bool cancelled = loadWatcher.isCanceled() || loadWatcher.future().resultCount() == 0;
+    if (progressDialog) {
+        disconnect(progressDialog, &QProgressDialog::canceled,
+                   &loadWatcher, &QFutureWatcher<MapLoadResult>::cancel);
+        progressDialog->close();
+        progressDialog = nullptr;
+    }
 
-        QMessageBox::information(this, "Success", message);
-    } else {
+    if (cancelled) {
+        statusBar()->showMessage("Map loading cancelled.", 5000);
+        return;
+    }
+
+    // The future holds a copy of the result; drop it so the graph swapped
+    // out below is freed with the local result instead of living on
+    MapLoadResult result = loadWatcher.result();
+    loadWatcher.setFuture(QFuture<MapLoadResult>());
+    if (!result.success) {
         QMessageBox::critical(this, "Error", "Failed to load map. Please check the file format.");
+        return;
     }
+
+    // Swap the finished graph in; the old one is freed when `result` goes
+    // out of scope at the end of this function.
+    // Vehicles and demand refer to the old node ids, so both start over.
+    simulator->setDemand(nullptr);
+    simulator->reset();
+    graph.swap(*result.graph);
+    mapLoaded = true;
+
+    demand.reset(new DemandModel(&graph));
+    demand->setUniform(SPAWN_RATE);
+    simulator->setDemand(demand.data());
+
+    locationModel->setLocations(result.locations);
+    mapView->setGraph(&graph);
+
+    // Enable pathfinding UI
+    ui->sourceCombo->setEnabled(true);
+    ui->destCombo->setEnabled(true);
+    ui->findPathButton->setEnabled(true);
+    ui->simulateButton->setEnabled(true);
+
+    statusBar()->showMessage(QString("✅ Map loaded: %1 nodes, %2 edges. "
+                                     "Select locations from dropdowns to find routes!")
+                                 .arg(graph.getNodeCount())
+                                 .arg(graph.getEdgeCount()));
 }
 
 void MainWindow::onFindPathClicked()
@@ -102,6 +215,8 @@ void MainWindow::onFindPathClicked()
         return;
     }
 
+    mapView->setRoute(result.path);
+
     // Build path string with location names
     QString pathStr = "Route:\n\n";
     for (int i = 0; i < result.path.size(); ++i) {
@@ -129,3 +244,30 @@ void MainWindow::onFindPathClicked()
 
     QMessageBox::information(this, "Route Found", message);
 }
+
+void MainWindow::onSimulateToggled(bool running)
+{
+    if (running) {
+        mapView->resetPaintTimes();
+        simulator->start();
+        statsTimer.start();
+        ui->simulateButton->setText("⏸ Pause Simulation");
+    } else {
+        simulator->stop();
+        statsTimer.stop();
+        ui->simulateButton->setText("🚗 Run Simulation");
+    }
+}
+
+void MainWindow::updateFrameStats()
+{
+    const LatencyHistogram& paint = mapView->paintTimes();
+    double p99 = paint.percentile(99.0) / 1000.0;
+
+    frameStatsLabel->setText(QString("%1 vehicles · paint p50 %2 ms, p99 %3 ms%4")
+                                 .arg(simulator->liveVehicleCount())
+                                 .arg(paint.percentile(50.0) / 1000.0, 0, 'f', 1)
+                                 .arg(p99, 0, 'f', 1)
+                                 .arg(p99 > FRAME_BUDGET_MS ? " (over 60 fps budget)" : ""));
+    mapView->resetPaintTimes();
+}
@@ -2,8 +2,20 @@
 #define MAINWINDOW_H
 
 #include <QMainWindow>
+#include <QFutureWatcher>
+#include <QPromise>
+#include <QSharedPointer>
+#include <QScopedPointer>
+#include <QTimer>
 #include "graph.h"
 
+class QLabel;
+class QProgressDialog;
+class TrafficSimulator;
+class DemandModel;
+class LocationListModel;
+class MapView;
+
 QT_BEGIN_NAMESPACE
 namespace Ui { class MainWindow; }
 QT_END_NAMESPACE
@@ -18,12 +30,35 @@ public:
 
 private slots:
     void onLoadMapClicked();
+    void onMapLoadFinished();
     void onFindPathClicked();
+    void onSimulateToggled(bool running);
+    void updateFrameStats();
 
 private:
+    // Produced by the background loader; the graph is swapped in on the GUI thread
+    struct MapLoadResult {
+        QSharedPointer<Graph> graph;
+        QList<Graph::NamedLocation> locations;
+        bool success = false;
+    };
+
     Ui::MainWindow *ui;
     Graph graph;
     bool mapLoaded;
+
+    LocationListModel *locationModel;
+    MapView *mapView;
+    QFutureWatcher<MapLoadResult> loadWatcher;
+    QProgressDialog *progressDialog;
+
+    // Live simulation drawn on the map; demand is rebuilt for each map
+    TrafficSimulator *simulator;
+    QScopedPointer<DemandModel> demand;
+    QTimer statsTimer;
+    QLabel *frameStatsLabel;
+
+    static void loadMap(QPromise<MapLoadResult>& promise, const QString& filePath);
 };
 
 #endif // MAINWINDOW_H
@@ -0,0 +1,479 @@
+#include "map_view.h"
+#include <QPainter>
+#include <QPaintEvent>
+#include <QWheelEvent>
+#include <QMouseEvent>
+#include <QHash>
+#include <QElapsedTimer>
+#include <QtMath>
+
+namespace {
+const double KM_PER_DEGREE = 111.32;
+
+// Zoom thresholds in pixels per km below which a draw tier is skipped
+const double MIN_PIXELS_PER_KM[] = { 0.0, 3.0, 15.0 };
+
+// Consecutive polyline points closer than this (in pixels) are merged
+const double SIMPLIFY_PIXELS = 1.5;
+}
+
+MapView::MapView(QWidget *parent)
+    : QWidget(parent)
+    , graph(nullptr)
+    , gridColumns(0)
+    , gridRows(0)
+    , currentStamp(0)
+    , zoomLevel(0)
+    , baseScale(0.0)
+    , lonFactor(1.0)
+    , tileCache(192)   // 256x256 ARGB tiles, ~48 MB
+{
+    setMinimumSize(300, 200);
+    setAttribute(Qt::WA_OpaquePaintEvent);
+}
+
+void MapView::setGraph(const Graph *g)
+{
+    graph = g;
+    route.clear();
+    vehicles.clear();
+    lights.clear();
+    buildIndex();
+    fitToMap();
+    update();
+}
+
+void MapView::invalidateTiles()
+{
+    tileCache.clear();
+    update();
+}
+
+void MapView::setRoute(const QVector<qint64>& path)
+{
+    route.clear();
+    if (graph) {
+        for (qint64 id : path) {
+            route.append(graph->getNode(id).pos);
+        }
+    }
+    update();
+}
+
+void MapView::setVehicles(const QVector<Vehicle>& v)
+{
+    vehicles = v;   // implicitly shared, no copy until the simulator writes
+    indexVehicles();
+    update();
+}
+
+void MapView::setTrafficLights(const QVector<TrafficLight>& l)
+{
+    lights = l;
+    update();
+}
+
+// ----------------------------------------------------------------------
+// Spatial index
+// ----------------------------------------------------------------------
+
+int MapView::drawTier(Graph::RoadClass roadClass)
+{
+    if (roadClass <= Graph::Primary) {
+        return 0;
+    }
+    if (roadClass <= Graph::Tertiary) {
+        return 1;
+    }
+    return 2;
+}
+
+int MapView::columnOf(double lon) const
+{
+    return qBound(0, int((lon - mapBounds.left()) / mapBounds.width() * gridColumns), gridColumns - 1);
+}
+
+int MapView::rowOf(double lat) const
+{
+    return qBound(0, int((lat - mapBounds.top()) / mapBounds.height() * gridRows), gridRows - 1);
+}
+
+void MapView::buildIndex()
+{
+    polylines.clear();
+    cells.clear();
+    tileCache.clear();
+    gridColumns = gridRows = 0;
+    mapBounds = QRectF();
+
+    if (!graph || graph->getNodeCount() == 0) {
+        return;
+    }
+
+    auto makePolyline = [this](const QVector<qint64>& nodeIds, Graph::RoadClass roadClass) {
+        Polyline line;
+        line.roadClass = roadClass;
+        for (qint64 id : nodeIds) {
+            if (graph->hasNode(id)) {
+                line.points.append(graph->getNode(id).pos);
+            }
+        }
+        if (line.points.size() < 2) {
+            return;
+        }
+        line.bounds = QPolygonF(line.points).boundingRect();
+        polylines.append(line);
+    };
+
+    if (!graph->ways.isEmpty()) {
+        for (const Graph::Way& way : graph->ways) {
+            makePolyline(way.nodeIds, Graph::roadClassOf(way.roadType()));
+        }
+    } else {
+        // Hand-built graphs have no ways: draw each edge once
+        for (auto it = graph->adj.cbegin(); it != graph->adj.cend(); ++it) {
+            for (const Graph::Edge& edge : it.value()) {
+                if (it.key() < edge.to || !graph->findEdge(edge.to, it.key())) {
+                    makePolyline(QVector<qint64>{it.key(), edge.to}, edge.roadClass);
+                }
+            }
+        }
+    }
+
+    double minLon = 180.0, maxLon = -180.0, minLat = 90.0, maxLat = -90.0;
+    for (auto it = graph->getNodes().cbegin(); it != graph->getNodes().cend(); ++it) {
+        minLon = qMin(minLon, it->lon);
+        maxLon = qMax(maxLon, it->lon);
+        minLat = qMin(minLat, it->lat);
+        maxLat = qMax(maxLat, it->lat);
+    }
+    mapBounds = QRectF(QPointF(minLon, minLat), QPointF(maxLon, maxLat));
+    if (mapBounds.width() <= 0.0 || mapBounds.height() <= 0.0) {
+        mapBounds.adjust(-0.005, -0.005, 0.005, 0.005);
+    }
+
+    // Roughly one polyline per cell on average
+    int side = qBound(1, int(qSqrt(polylines.size())), 512);
+    gridColumns = side;
+    gridRows = side;
+    cells.resize(gridColumns * gridRows);
+
+    for (int i = 0; i < polylines.size(); ++i) {
+        const Polyline& line = polylines[i];
+
+        // Bucket by each segment's bounding box, so long diagonal ways
+        // don't claim every cell of their overall bounds
+        for (int k = 0; k + 1 < line.points.size(); ++k) {
+            const QPointF& a = line.points[k];
+            const QPointF& b = line.points[k + 1];
+            for (int r = rowOf(qMin(a.y(), b.y())); r <= rowOf(qMax(a.y(), b.y())); ++r) {
+                for (int c = columnOf(qMin(a.x(), b.x())); c <= columnOf(qMax(a.x(), b.x())); ++c) {
+                    QVector<int>& cell = cells[r * gridColumns + c];
+                    if (cell.isEmpty() || cell.last() != i) {
+                        cell.append(i);
+                    }
+                }
+            }
+        }
+    }
+
+    visitStamp.fill(0, polylines.size());
+    currentStamp = 0;
+    indexVehicles();
+}
+
+// Counting sort of the active vehicles by grid cell: two passes over the
+// vehicles, no per-cell allocations
+void MapView::indexVehicles()
+{
+    vehicleCellStart.fill(0, cells.size() + 1);
+    vehicleOrder.clear();
+    if (cells.isEmpty()) {
+        return;
+    }
+
+    vehicleCell.resize(vehicles.size());
+    for (int i = 0; i < vehicles.size(); ++i) {
+        const Vehicle& v = vehicles[i];
+        if (!v.active) {
+            vehicleCell[i] = -1;
+            continue;
+        }
+        int cell = rowOf(v.position.y()) * gridColumns + columnOf(v.position.x());
+        vehicleCell[i] = cell;
+        vehicleCellStart[cell + 1]++;
+    }
+    for (int c = 0; c < cells.size(); ++c) {
+        vehicleCellStart[c + 1] += vehicleCellStart[c];
+    }
+
+    vehicleOrder.resize(vehicleCellStart.last());
+    QVector<int> next(vehicleCellStart.cbegin(), vehicleCellStart.cend() - 1);
+    for (int i = 0; i < vehicles.size(); ++i) {
+        if (vehicleCell[i] >= 0) {
+            vehicleOrder[next[vehicleCell[i]]++] = i;
+        }
+    }
+}
+
+template <typename Visit>
+void MapView::forEachPolylineIn(const QRectF& rect, Visit visit) const
+{
+    if (cells.isEmpty() || !rect.intersects(mapBounds)) {
+        return;
+    }
+
+    int c0 = columnOf(rect.left());
+    int c1 = columnOf(rect.right());
+    int r0 = rowOf(rect.top());
+    int r1 = rowOf(rect.bottom());
+
+    // Stamps dedupe polylines that span several cells without a set
+    if (++currentStamp == 0) {
+        visitStamp.fill(0);
+        currentStamp = 1;
+    }
+
+    for (int r = r0; r <= r1; ++r) {
+        for (int c = c0; c <= c1; ++c) {
+            for (int i : cells[r * gridColumns + c]) {
+                if (visitStamp[i] == currentStamp) {
+                    continue;
+                }
+                visitStamp[i] = currentStamp;
+                if (polylines[i].bounds.intersects(rect) || polylines[i].bounds.isEmpty()) {
+                    visit(polylines[i]);
+                }
+            }
+        }
+    }
+}
+
+// ----------------------------------------------------------------------
+// View transform
+// ----------------------------------------------------------------------
+
+double MapView::scale() const
+{
+    return baseScale * qPow(2.0, zoomLevel / 2.0);
+}
+
+QPointF MapView::toWorld(const QPointF& lonLat) const
+{
+    double s = scale();
+    return QPointF((lonLat.x() - mapBounds.left()) * s * lonFactor,
+                   (mapBounds.bottom() - lonLat.y()) * s);
+}
+
+QPointF MapView::toLonLat(const QPointF& world) const
+{
+    double s = scale();
+    return QPointF(world.x() / (s * lonFactor) + mapBounds.left(),
+                   mapBounds.bottom() - world.y() / s);
+}
+
+void MapView::fitToMap()
+{
+    tileCache.clear();
+    zoomLevel = 0;
+    if (mapBounds.isNull()) {
+        baseScale = 0.0;
+        return;
+    }
+
+    lonFactor = qCos(qDegreesToRadians(mapBounds.center().y()));
+
+    QSizeF viewSize = size().isEmpty() ? QSizeF(800, 600) : QSizeF(size());
+    baseScale = 0.95 * qMin(viewSize.width() / (mapBounds.width() * lonFactor),
+                            viewSize.height() / mapBounds.height());
+
+    viewOffset = toWorld(mapBounds.center()) - QPointF(viewSize.width() / 2.0, viewSize.height() / 2.0);
+}
+
+void MapView::zoomAt(const QPoint& anchor, int steps)
+{
+    if (baseScale <= 0.0 || steps == 0) {
+        return;
+    }
+
+    QPointF lonLat = toLonLat(viewOffset + anchor);
+    zoomLevel = qBound(-6, zoomLevel + steps, 40);
+    viewOffset = toWorld(lonLat) - QPointF(anchor);
+    update();
+}
+
+// ----------------------------------------------------------------------
+// Rendering
+// ----------------------------------------------------------------------
+
+QPixmap MapView::renderTile(int tx, int ty) const
+{
+    QPixmap tile(TileSize, TileSize);
+    tile.fill(Qt::transparent);
+
+    QPainter painter(&tile);
+    painter.setRenderHint(QPainter::Antialiasing);
+    painter.translate(-tx * TileSize, -ty * TileSize);
+
+    // Pad the query so strokes crossing the tile border are not cut off
+    const double pad = 4.0;
+    QRectF world(tx * TileSize - pad, ty * TileSize - pad, TileSize + 2 * pad, TileSize + 2 * pad);
+    QRectF lonLat = QRectF(toLonLat(world.bottomLeft()), toLonLat(world.topRight())).normalized();
+
+    double pixelsPerKm = scale() / KM_PER_DEGREE;
+
+    static const QPen pens[] = {
+        QPen(QColor(240, 170, 60), 3.0, Qt::SolidLine, Qt::RoundCap, Qt::RoundJoin),
+        QPen(QColor(250, 220, 120), 2.0, Qt::SolidLine, Qt::RoundCap, Qt::RoundJoin),
+        QPen(QColor(170, 170, 170), 1.0, Qt::SolidLine, Qt::RoundCap, Qt::RoundJoin),
+    };
+
+    // Draw minor roads first so major ones end up on top
+    for (int tier = 2; tier >= 0; --tier) {
+        if (pixelsPerKm < MIN_PIXELS_PER_KM[tier]) {
+            continue;
+        }
+        painter.setPen(pens[tier]);
+
+        forEachPolylineIn(lonLat, [&](const Polyline& line) {
+            if (drawTier(line.roadClass) != tier) {
+                return;
+            }
+
+            // Radial-distance simplification at the current zoom
+            QPolygonF simplified;
+            QPointF last = toWorld(line.points.first());
+            simplified.append(last);
+            for (int k = 1; k < line.points.size(); ++k) {
+                QPointF p = toWorld(line.points[k]);
+                bool isLast = (k == line.points.size() - 1);
+                if (isLast || qAbs(p.x() - last.x()) + qAbs(p.y() - last.y()) >= SIMPLIFY_PIXELS) {
+                    simplified.append(p);
+                    last = p;
+                }
+            }
+            painter.drawPolyline(simplified);
+        });
+    }
+
+    return tile;
+}
+
+void MapView::paintEvent(QPaintEvent *event)
+{
+    Q_UNUSED(event);
+
+    QElapsedTimer paintClock;
+    paintClock.start();
+
+    QPainter painter(this);
+    painter.fillRect(rect(), QColor(245, 243, 238));
+
+    if (!graph || baseScale <= 0.0) {
+        painter.drawText(rect(), Qt::AlignCenter, "Load a map to see it here");
+        return;
+    }
+
+    // Static road layer from cached tiles
+    int tx0 = qFloor(viewOffset.x() / TileSize);
+    int ty0 = qFloor(viewOffset.y() / TileSize);
+    int tx1 = qFloor((viewOffset.x() + width()) / TileSize);
+    int ty1 = qFloor((viewOffset.y() + height()) / TileSize);
+
+    for (int ty = ty0; ty <= ty1; ++ty) {
+        for (int tx = tx0; tx <= tx1; ++tx) {
+            quint64 key = (quint64(zoomLevel + 128) << 56)
+                          | (quint64(tx + (1 << 27)) << 28)
+                          | quint64(ty + (1 << 27));
+            QPixmap *tile = tileCache.object(key);
+            if (!tile) {
+                tile = new QPixmap(renderTile(tx, ty));
+                tileCache.insert(key, tile);
+            }
+            painter.drawPixmap(QPointF(tx * TileSize, ty * TileSize) - viewOffset, *tile);
+        }
+    }
+
+    painter.setRenderHint(QPainter::Antialiasing);
+
+    // Highlighted route
+    if (route.size() >= 2) {
+        QPolygonF line;
+        for (const QPointF& p : route) {
+            line.append(toScreen(p));
+        }
+        painter.setPen(QPen(QColor(40, 110, 230), 4.0, Qt::SolidLine, Qt::RoundCap, Qt::RoundJoin));
+        painter.drawPolyline(line);
+    }
+
+    QRectF visible = QRectF(rect()).adjusted(-4, -4, 4, 4);
+
+    // Traffic lights, batched into one draw call per state
+    QVector<QPointF> green, red;
+    for (const TrafficLight& light : lights) {
+        QPointF p = toScreen(graph->getNode(light.nodeId).pos);
+        if (visible.contains(p)) {
+            (light.isGreen ? green : red).append(p);
+        }
+    }
+    painter.setPen(QPen(QColor(30, 170, 60), 6.0, Qt::SolidLine, Qt::RoundCap));
+    painter.drawPoints(green.constData(), green.size());
+    painter.setPen(QPen(QColor(220, 40, 40), 6.0, Qt::SolidLine, Qt::RoundCap));
+    painter.drawPoints(red.constData(), red.size());
+
+    // Vehicles from the grid cells in view, grouped by colour so each
+    // colour is one draw call
+    QHash<QRgb, QVector<QPointF>> batches;
+    if (!vehicleOrder.isEmpty()) {
+        QRectF viewLonLat = QRectF(toLonLat(viewOffset + visible.bottomLeft()),
+                                   toLonLat(viewOffset + visible.topRight())).normalized();
+        int c0 = columnOf(viewLonLat.left());
+        int c1 = columnOf(viewLonLat.right());
+        for (int r = rowOf(viewLonLat.top()); r <= rowOf(viewLonLat.bottom()); ++r) {
+            for (int k = vehicleCellStart[r * gridColumns + c0];
+                 k < vehicleCellStart[r * gridColumns + c1 + 1]; ++k) {
+                const Vehicle& v = vehicles[vehicleOrder[k]];
+                QPointF p = toScreen(v.position);
+                if (visible.contains(p)) {
+                    batches[v.color.rgb()].append(p);
+                }
+            }
+        }
+    }
+
+    painter.setRenderHint(QPainter::Antialiasing, false);
+    for (auto it = batches.cbegin(); it != batches.cend(); ++it) {
+        painter.setPen(QPen(QColor::fromRgb(it.key()), 4.0, Qt::SolidLine, Qt::SquareCap));
+        painter.drawPoints(it->constData(), it->size());
+    }
+
+    paintHistogram.record(paintClock.nsecsElapsed() / 1000);
+}
+
+void MapView::resizeEvent(QResizeEvent *event)
+{
+    QWidget::resizeEvent(event);
+    if (baseScale <= 0.0 && !mapBounds.isNull()) {
+        fitToMap();
+    }
+}
+
+void MapView::wheelEvent(QWheelEvent *event)
+{
+    zoomAt(event->position().toPoint(), event->angleDelta().y() / 120);
+    event->accept();
+}
+
+void MapView::mousePressEvent(QMouseEvent *event)
+{
+    lastMousePos = event->pos();
+}
+
+void MapView::mouseMoveEvent(QMouseEvent *event)
+{
+    if (event->buttons() & Qt::LeftButton) {
+        viewOffset -= QPointF(event->pos() - lastMousePos);
+        lastMousePos = event->pos();
+        update();
+    }
+}
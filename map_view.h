@@ -0,0 +1,103 @@
+#ifndef MAP_VIEW_H
+#define MAP_VIEW_H
+
+#include <QWidget>
+#include <QCache>
+#include <QPixmap>
+#include <QVector>
+#include <QRectF>
+#include "graph.h"
+#include "traffic_simulator.h"
+#include "simulation_metrics.h"
+
+// Map widget for road edges, traffic lights, vehicles and a highlighted
+// route. Roads are kept as per-way polylines in a uniform grid index and
+// rendered into cached 256 px tiles per zoom level; each polyline is
+// simplified to the current zoom and minor road classes are dropped when
+// zoomed out. Vehicles are bucketed into the same grid on every update,
+// so a frame only visits the cells in view; they and the lights are drawn
+// in batches on top of the tiles.
+class MapView : public QWidget
+{
+    Q_OBJECT
+
+public:
+    explicit MapView(QWidget *parent = nullptr);
+
+    void setGraph(const Graph *graph);   // rebuilds the index and fits the view
+    void invalidateTiles();              // call after edges were changed
+    void setRoute(const QVector<qint64>& path);
+
+    // Paint time per frame, to check the view against its frame budget
+    const LatencyHistogram& paintTimes() const { return paintHistogram; }
+    void resetPaintTimes() { paintHistogram.reset(); }
+
+public slots:
+    void setVehicles(const QVector<Vehicle>& vehicles);
+    void setTrafficLights(const QVector<TrafficLight>& lights);
+
+protected:
+    void paintEvent(QPaintEvent *event) override;
+    void resizeEvent(QResizeEvent *event) override;
+    void wheelEvent(QWheelEvent *event) override;
+    void mousePressEvent(QMouseEvent *event) override;
+    void mouseMoveEvent(QMouseEvent *event) override;
+
+private:
+    static const int TileSize = 256;
+
+    struct Polyline {
+        QVector<QPointF> points;   // (lon, lat)
+        QRectF bounds;             // (lon, lat)
+        Graph::RoadClass roadClass;
+    };
+
+    const Graph *graph;
+
+    // Spatial index: polylines bucketed by the grid cells they overlap
+    QVector<Polyline> polylines;
+    QVector<QVector<int>> cells;
+    int gridColumns;
+    int gridRows;
+    QRectF mapBounds;              // (lon, lat)
+    mutable QVector<quint32> visitStamp;
+    mutable quint32 currentStamp;
+
+    // Vehicles by grid cell: indices into `vehicles`, grouped per cell
+    QVector<int> vehicleCellStart; // cells + 1 offsets into vehicleOrder
+    QVector<int> vehicleOrder;
+    QVector<int> vehicleCell;      // scratch: cell of each vehicle, -1 if inactive
+
+    // View: world pixels are an equirectangular projection of mapBounds
+    int zoomLevel;
+    double baseScale;              // pixels per degree latitude at zoom 0
+    double lonFactor;              // cos(mid latitude)
+    QPointF viewOffset;            // world pixel at the widget's top-left
+    QPoint lastMousePos;
+
+    QCache<quint64, QPixmap> tileCache;
+
+    QVector<Vehicle> vehicles;
+    QVector<TrafficLight> lights;
+    QVector<QPointF> route;        // (lon, lat)
+
+    LatencyHistogram paintHistogram;
+
+    static int drawTier(Graph::RoadClass roadClass);   // 0 = major, 1 = secondary, 2 = minor
+    int columnOf(double lon) const;
+    int rowOf(double lat) const;
+    void buildIndex();
+    void indexVehicles();
+    void fitToMap();
+    double scale() const;
+    QPointF toWorld(const QPointF& lonLat) const;
+    QPointF toLonLat(const QPointF& world) const;
+    QPointF toScreen(const QPointF& lonLat) const { return toWorld(lonLat) - viewOffset; }
+    void zoomAt(const QPoint& anchor, int steps);
+
+    QPixmap renderTile(int tx, int ty) const;
+    template <typename Visit>
+    void forEachPolylineIn(const QRectF& lonLatRect, Visit visit) const;
+};
+
+#endif // MAP_VIEW_H
@@ -0,0 +1,77 @@
+#include "path_arena.h"
+#include <QDataStream>
+
+PathArena::Ref PathArena::allocate(const QVector<int>& denseIndices)
+{
+    Ref ref;
+    ref.offset = quint32(data.size());
+    ref.length = quint32(denseIndices.size());
+
+    int previous = 0;
+    for (int index : denseIndices) {
+        data.append(qint32(index - previous));
+        previous = index;
+    }
+    return ref;
+}
+
+void PathArena::release(Ref& ref)
+{
+    garbageWords += int(ref.length);
+    ref = Ref();
+}
+
+QVector<int> PathArena::decode(const Ref& ref) const
+{
+    QVector<int> indices;
+    indices.reserve(int(ref.length));
+
+    int index = 0;
+    for (quint32 k = 0; k < ref.length; ++k) {
+        index += data[ref.offset + k];
+        indices.append(index);
+    }
+    return indices;
+}
+
+PathArena::Ref PathArena::copyFrom(const PathArena& other, const Ref& ref)
+{
+    Ref copy;
+    copy.offset = quint32(data.size());
+    copy.length = ref.length;
+
+    // Deltas are position independent, so the words copy verbatim
+    data.append(other.data.mid(int(ref.offset), int(ref.length)));
+    return copy;
+}
+
+bool PathArena::needsCompaction() const
+{
+    const int MIN_GARBAGE = 4096;
+    return garbageWords > MIN_GARBAGE && garbageWords * 2 > data.size();
+}
+
+void PathArena::clear()
+{
+    data.clear();
+    garbageWords = 0;
+}
+
+void PathArena::save(QDataStream& out) const
+{
+    out << qint32(garbageWords) << data;
+}
+
+bool PathArena::load(QDataStream& in)
+{
+    qint32 garbage;
+    QVector<qint32> loaded;
+    in >> garbage >> loaded;
+    if (in.status() != QDataStream::Ok) {
+        return false;
+    }
+
+    data = loaded;
+    garbageWords = garbage;
+    return true;
+}
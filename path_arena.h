@@ -0,0 +1,50 @@
+#ifndef PATH_ARENA_H
+#define PATH_ARENA_H
+
+#include <QtGlobal>
+#include <QVector>
+
+class QDataStream;
+
+// Shared storage for vehicle routes. A route is a run of 32-bit words in
+// one contiguous buffer: the first word is the dense node index of the
+// start node (see Graph::nodeIndexOf), every following word is the delta
+// to the previous node's index. Released routes leave garbage behind
+// that is reclaimed by compaction.
+class PathArena
+{
+public:
+    struct Ref {
+        quint32 offset;
+        quint32 length;   // number of nodes
+
+        Ref() : offset(0), length(0) {}
+    };
+
+    PathArena() : garbageWords(0) {}
+
+    Ref allocate(const QVector<int>& denseIndices);
+    void release(Ref& ref);
+
+    // First node index, or the delta between nodes k-1 and k
+    qint32 first(const Ref& ref) const { return data[ref.offset]; }
+    qint32 delta(const Ref& ref, int k) const { return data[ref.offset + k]; }
+    QVector<int> decode(const Ref& ref) const;
+
+    // Copy a route out of another arena (used when compacting)
+    Ref copyFrom(const PathArena& other, const Ref& ref);
+
+    int sizeInWords() const { return data.size(); }
+    int garbageInWords() const { return garbageWords; }
+    bool needsCompaction() const;
+    void clear();
+
+    void save(QDataStream& out) const;
+    bool load(QDataStream& in);
+
+private:
+    QVector<qint32> data;
+    int garbageWords;
+};
+
+#endif // PATH_ARENA_H
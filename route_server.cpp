@@ -0,0 +1,406 @@
+#include "route_server.h"
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonValue>
+#include <QtMath>
+#include <QDebug>
+#include <limits>
+
+namespace {
+const int DEFAULT_LOOKUP_LIMIT = 10;
+const int MAX_LOOKUP_LIMIT = 100;
+const double KM_PER_DEGREE = 111.195;   // mean Earth radius, per degree of arc
+
+QJsonObject failure(const QString& message)
+{
+    QJsonObject reply;
+    reply["ok"] = false;
+    reply["error"] = message;
+    return reply;
+}
+}
+
+RouteServer::RouteServer(const Graph* g, QObject* parent)
+    : QObject(parent),
+    graph(g),
+    nextClientId(1),
+    requestCount(0),
+    errorCount(0)
+{
+    connect(&server, &QLocalServer::newConnection, this, &RouteServer::acceptConnection);
+    buildGrid();
+}
+
+RouteServer::~RouteServer()
+{
+    // Queries in flight still read the graph and the grid
+    workers.waitForDone();
+}
+
+bool RouteServer::listen(const QString& serverName)
+{
+    // A stale socket file from a crashed run would make listen() fail
+    QLocalServer::removeServer(serverName);
+    if (!server.listen(serverName)) {
+        qWarning() << "Route server cannot listen on" << serverName << server.errorString();
+        return false;
+    }
+    return true;
+}
+
+void RouteServer::setWorkerCount(int threads)
+{
+    workers.setMaxThreadCount(qMax(1, threads));
+}
+
+const char* RouteServer::queryName(QueryType type)
+{
+    switch (type) {
+    case QueryRoute:   return "route";
+    case QueryNearest: return "nearest";
+    case QueryLookup:  return "lookup";
+    default:           return "unknown";
+    }
+}
+
+QJsonObject RouteServer::statistics() const
+{
+    QJsonObject queries;
+    for (int t = 0; t < QueryTypeCount; ++t) {
+        const LatencyHistogram& h = latencies[t];
+        QJsonObject query;
+        query["count"] = double(h.count());
+        query["mean_us"] = h.mean();
+        query["p50_us"] = double(h.percentile(50.0));
+        query["p90_us"] = double(h.percentile(90.0));
+        query["p99_us"] = double(h.percentile(99.0));
+        query["max_us"] = double(h.max());
+        queries[QString::fromLatin1(queryName(QueryType(t)))] = query;
+    }
+
+    QJsonObject stats;
+    stats["ok"] = true;
+    stats["requests"] = double(requestCount);
+    stats["errors"] = double(errorCount);
+    stats["workers"] = workers.maxThreadCount();
+    stats["queries"] = queries;
+    return stats;
+}
+
+// ----------------------------------------------------------------------
+// Connections
+// ----------------------------------------------------------------------
+
+void RouteServer::acceptConnection()
+{
+    while (QLocalSocket* socket = server.nextPendingConnection()) {
+        quint64 clientId = nextClientId++;
+        socket->setParent(this);
+
+        Client client;
+        client.socket = socket;
+        clients.insert(clientId, client);
+
+        connect(socket, &QLocalSocket::readyRead, this, [this, clientId]() {
+            readRequests(clientId);
+        });
+        connect(socket, &QLocalSocket::disconnected, this, [this, clientId, socket]() {
+            // Replies still being computed are dropped in deliver()
+            clients.remove(clientId);
+            socket->deleteLater();
+        });
+    }
+}
+
+void RouteServer::readRequests(quint64 clientId)
+{
+    auto it = clients.find(clientId);
+    if (it == clients.end())
+        return;
+
+    QLocalSocket* socket = it->socket;
+    while (socket->canReadLine()) {
+        QByteArray line = socket->readLine().trimmed();
+        if (line.isEmpty())
+            continue;
+
+        quint64 sequence = it->nextSequence++;
+        QElapsedTimer clock;
+        clock.start();
+
+        QJsonParseError error;
+        QJsonDocument document = QJsonDocument::fromJson(line, &error);
+        if (error.error != QJsonParseError::NoError || (!document.isArray() && !document.isObject())) {
+            QJsonObject reply = failure("Invalid request: " + error.errorString());
+            deliver(clientId, sequence, QJsonDocument(reply).toJson(QJsonDocument::Compact) + '\n',
+                    QVector<QueryType>(), 0, 1);
+            continue;
+        }
+
+        bool batch = document.isArray();
+        QJsonArray requests = batch ? document.array() : QJsonArray{ document.object() };
+
+        // Statistics live on this thread, so they are snapshotted here
+        QJsonObject stats;
+        for (const QJsonValue& value : requests) {
+            if (value.toObject().value("op").toString() == "stats") {
+                stats = statistics();
+                break;
+            }
+        }
+
+        workers.start([this, clientId, sequence, requests, batch, clock, stats]() {
+            QJsonArray replies;
+            QVector<QueryType> types;
+            int errors = 0;
+
+            for (const QJsonValue& value : requests) {
+                QJsonObject request = value.toObject();
+                QJsonObject reply;
+                if (request.value("op").toString() == "stats") {
+                    reply = stats;
+                } else {
+                    QueryType type = QueryTypeCount;
+                    reply = answer(request, type);
+                    if (type != QueryTypeCount)
+                        types.append(type);
+                }
+
+                if (request.contains("id"))
+                    reply["id"] = request.value("id");
+                if (!reply.value("ok").toBool())
+                    errors++;
+                replies.append(reply);
+            }
+
+            QJsonDocument document = batch ? QJsonDocument(replies)
+                                           : QJsonDocument(replies.first().toObject());
+            QByteArray out = document.toJson(QJsonDocument::Compact) + '\n';
+            qint64 elapsed = clock.nsecsElapsed();
+
+            QMetaObject::invokeMethod(this, [=]() {
+                deliver(clientId, sequence, out, types, elapsed, errors);
+            }, Qt::QueuedConnection);
+        });
+    }
+}
+
+// Runs on the server thread. Replies are held back until every earlier
+// line of the same client has been answered. All requests of a batch are
+// recorded with the latency of the whole batch.
+void RouteServer::deliver(quint64 clientId, quint64 sequence, const QByteArray& reply,
+                          const QVector<QueryType>& types, qint64 elapsedNanos, int errors)
+{
+    requestCount += qMax(1, int(types.size()));
+    errorCount += errors;
+    for (QueryType type : types)
+        latencies[type].record(elapsedNanos / 1000);
+
+    auto it = clients.find(clientId);
+    if (it == clients.end())
+        return;
+
+    it->ready.insert(sequence, reply);
+    while (!it->ready.isEmpty() && it->ready.firstKey() == it->nextToWrite) {
+        it->socket->write(it->ready.take(it->nextToWrite));
+        it->nextToWrite++;
+    }
+}
+
+// ----------------------------------------------------------------------
+// Queries (worker threads)
+// ----------------------------------------------------------------------
+
+QJsonObject RouteServer::answer(const QJsonObject& request, QueryType& type) const
+{
+    const QString op = request.value("op").toString();
+    if (op == "route") {
+        type = QueryRoute;
+        return routeQuery(request);
+    }
+    if (op == "nearest") {
+        type = QueryNearest;
+        return nearestQuery(request);
+    }
+    if (op == "lookup") {
+        type = QueryLookup;
+        return lookupQuery(request);
+    }
+    return failure(QString("Unknown op \"%1\"").arg(op));
+}
+
+QJsonObject RouteServer::routeQuery(const QJsonObject& request) const
+{
+    qint64 from = request.value("from").toInteger(-1);
+    qint64 to = request.value("to").toInteger(-1);
+
+    const QString metricName = request.value("metric").toString("distance");
+    Graph::RouteMetric metric;
+    if (metricName == "distance") {
+        metric = Graph::ShortestDistance;
+    } else if (metricName == "time") {
+        metric = Graph::FreeFlowTime;
+    } else if (metricName == "truck") {
+        metric = Graph::TruckTime;
+    } else {
+        return failure(QString("Unknown metric \"%1\"").arg(metricName));
+    }
+
+    Graph::PathResult result = graph->dijkstra(from, to, metric);
+    if (!result.found)
+        return failure(result.errorMessage);
+
+    QJsonArray path;
+    for (qint64 id : result.path)
+        path.append(id);
+
+    QJsonObject reply;
+    reply["ok"] = true;
+    reply["path"] = path;
+    reply["distance_km"] = result.totalDistance;
+    reply["cost"] = result.totalCost;
+    return reply;
+}
+
+QJsonObject RouteServer::nearestQuery(const QJsonObject& request) const
+{
+    if (!request.value("lat").isDouble() || !request.value("lon").isDouble())
+        return failure("nearest needs numeric \"lat\" and \"lon\"");
+
+    double distanceKm;
+    int index = nearestNode(request.value("lat").toDouble(), request.value("lon").toDouble(),
+                            distanceKm);
+    if (index < 0)
+        return failure("Map has no nodes");
+
+    const Graph::Node& node = graph->getNode(graph->nodeIdAt(index));
+    QJsonObject reply;
+    reply["ok"] = true;
+    reply["node"] = node.id;
+    reply["lat"] = node.lat;
+    reply["lon"] = node.lon;
+    reply["distance_km"] = distanceKm;
+    return reply;
+}
+
+QJsonObject RouteServer::lookupQuery(const QJsonObject& request) const
+{
+    const QString name = request.value("name").toString();
+    if (name.isEmpty())
+        return failure("lookup needs a \"name\"");
+
+    int limit = qBound(1, request.value("limit").toInt(DEFAULT_LOOKUP_LIMIT), MAX_LOOKUP_LIMIT);
+    QJsonArray matches;
+    auto addMatch = [&matches](const QString& displayName, qint64 nodeId) {
+        QJsonObject match;
+        match["name"] = displayName;
+        match["node"] = nodeId;
+        matches.append(match);
+    };
+
+    // An exact display name wins; otherwise a case-insensitive substring scan
+    qint64 exact = graph->findNodeByName(name);
+    if (exact >= 0) {
+        addMatch(name, exact);
+    } else {
+        for (auto it = graph->nameToNodeId.cbegin();
+             it != graph->nameToNodeId.cend() && matches.size() < limit; ++it) {
+            if (it.key().contains(name, Qt::CaseInsensitive))
+                addMatch(it.key(), it.value());
+        }
+    }
+
+    QJsonObject reply;
+    reply["ok"] = true;
+    reply["matches"] = matches;
+    return reply;
+}
+
+// ----------------------------------------------------------------------
+// Nearest-node grid
+// ----------------------------------------------------------------------
+
+void RouteServer::buildGrid()
+{
+    int nodeCount = graph->denseIds.size();
+    if (nodeCount == 0)
+        return;
+
+    double minLat = 90.0, maxLat = -90.0, minLon = 180.0, maxLon = -180.0;
+    for (int i = 0; i < nodeCount; ++i) {
+        const Graph::Node& node = graph->getNode(graph->nodeIdAt(i));
+        minLat = qMin(minLat, node.lat);
+        maxLat = qMax(maxLat, node.lat);
+        minLon = qMin(minLon, node.lon);
+        maxLon = qMax(maxLon, node.lon);
+    }
+
+    // About four nodes per cell
+    grid.lonScale = qMax(0.01, qCos(qDegreesToRadians((minLat + maxLat) / 2.0)));
+    double width = (maxLon - minLon) * grid.lonScale;
+    double height = maxLat - minLat;
+    double area = qMax(width * height, 1e-12);
+    grid.cellSize = qMax(1e-6, qSqrt(area / qMax(1, nodeCount / 4)));
+    grid.minLat = minLat;
+    grid.minLon = minLon;
+    grid.columns = qMax(1, int(width / grid.cellSize) + 1);
+    grid.rows = qMax(1, int(height / grid.cellSize) + 1);
+    grid.cells.resize(grid.columns * grid.rows);
+
+    for (int i = 0; i < nodeCount; ++i) {
+        const Graph::Node& node = graph->getNode(graph->nodeIdAt(i));
+        int column = qMin(grid.columns - 1, int((node.lon - minLon) * grid.lonScale / grid.cellSize));
+        int row = qMin(grid.rows - 1, int((node.lat - minLat) / grid.cellSize));
+        grid.cells[row * grid.columns + column].append(i);
+    }
+}
+
+// Scans rings of cells around the query point until the best candidate is
+// closer than anything in the next ring could be. Distances use the
+// equirectangular approximation, which is exact enough at city scale.
+int RouteServer::nearestNode(double lat, double lon, double& distanceKm) const
+{
+    if (grid.cells.isEmpty())
+        return -1;
+
+    double x = (lon - grid.minLon) * grid.lonScale;
+    double y = lat - grid.minLat;
+    int column = qBound(0, int(x / grid.cellSize), grid.columns - 1);
+    int row = qBound(0, int(y / grid.cellSize), grid.rows - 1);
+
+    int best = -1;
+    double bestDistance = std::numeric_limits<double>::infinity();   // scaled degrees
+    int maxRing = qMax(grid.columns, grid.rows);
+
+    for (int ring = 0; ring <= maxRing; ++ring) {
+        for (int r = row - ring; r <= row + ring; ++r) {
+            if (r < 0 || r >= grid.rows)
+                continue;
+            for (int c = column - ring; c <= column + ring; ++c) {
+                if (c < 0 || c >= grid.columns)
+                    continue;
+                // Only the border of the ring is new
+                if (r != row - ring && r != row + ring && c != column - ring && c != column + ring)
+                    continue;
+
+                for (int index : grid.cells[r * grid.columns + c]) {
+                    const Graph::Node& node = graph->getNode(graph->nodeIdAt(index));
+                    double dx = (node.lon - lon) * grid.lonScale;
+                    double dy = node.lat - lat;
+                    double d = qSqrt(dx * dx + dy * dy);
+                    if (d < bestDistance) {
+                        bestDistance = d;
+                        best = index;
+                    }
+                }
+            }
+        }
+
+        // Points outside the scanned square are at least `ring` cells away
+        if (best >= 0 && bestDistance <= ring * grid.cellSize)
+            break;
+    }
+
+    distanceKm = bestDistance * KM_PER_DEGREE;
+    return best;
+}
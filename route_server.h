@@ -0,0 +1,95 @@
+#ifndef ROUTE_SERVER_H
+#define ROUTE_SERVER_H
+
+#include <QObject>
+#include <QHash>
+#include <QMap>
+#include <QVector>
+#include <QThreadPool>
+#include <QElapsedTimer>
+#include <QJsonObject>
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <array>
+#include "graph.h"
+#include "simulation_metrics.h"
+
+// Headless query server over a resident Graph. Clients connect to a
+// QLocalServer and send line-delimited JSON; each line is one request
+// object or an array of them (a batch). Requests are answered on a worker
+// pool, and replies are written one line per request line, in request
+// order, so clients may pipeline without waiting:
+//
+//   {"id": 1, "op": "route", "from": 123, "to": 456, "metric": "time"}
+//   {"id": 2, "op": "nearest", "lat": 24.86, "lon": 67.00}
+//   {"id": 3, "op": "lookup", "name": "Saddar", "limit": 5}
+//   {"id": 4, "op": "stats"}
+//
+// The graph must not be modified while the server is running.
+class RouteServer : public QObject
+{
+    Q_OBJECT
+public:
+    enum QueryType {
+        QueryRoute = 0,
+        QueryNearest,
+        QueryLookup,
+        QueryTypeCount
+    };
+
+    explicit RouteServer(const Graph* graph, QObject* parent = nullptr);
+    ~RouteServer();
+
+    bool listen(const QString& serverName);
+    void setWorkerCount(int threads);
+
+    // Server-side latency, from a line being read to its reply being queued
+    const LatencyHistogram& latency(QueryType type) const { return latencies[type]; }
+    QJsonObject statistics() const;
+    static const char* queryName(QueryType type);
+
+private slots:
+    void acceptConnection();
+
+private:
+    // Spatial grid for nearest-node queries; cells are square in
+    // (lon * cos(lat), lat) space
+    struct NodeGrid {
+        double minLat = 0.0, minLon = 0.0;
+        double cellSize = 1.0;        // degrees of latitude
+        double lonScale = 1.0;        // cos(mid latitude)
+        int columns = 0, rows = 0;
+        QVector<QVector<int>> cells;  // dense node indices
+    };
+
+    struct Client {
+        QLocalSocket* socket;
+        quint64 nextSequence = 0;       // assigned to the next line read
+        quint64 nextToWrite = 0;        // replies are flushed in this order
+        QMap<quint64, QByteArray> ready;
+    };
+
+    const Graph* graph;
+    QLocalServer server;
+    QThreadPool workers;
+    NodeGrid grid;
+    QHash<quint64, Client> clients;
+    quint64 nextClientId;
+    std::array<LatencyHistogram, QueryTypeCount> latencies;
+    quint64 requestCount;
+    quint64 errorCount;
+
+    void buildGrid();
+    void readRequests(quint64 clientId);
+    void deliver(quint64 clientId, quint64 sequence, const QByteArray& reply,
+                 const QVector<QueryType>& types, qint64 elapsedNanos, int errors);
+
+    // Run on worker threads; only read the graph and the grid
+    QJsonObject answer(const QJsonObject& request, QueryType& type) const;
+    QJsonObject routeQuery(const QJsonObject& request) const;
+    QJsonObject nearestQuery(const QJsonObject& request) const;
+    QJsonObject lookupQuery(const QJsonObject& request) const;
+    int nearestNode(double lat, double lon, double& distanceKm) const;
+};
+
+#endif // ROUTE_SERVER_H
@@ -0,0 +1,290 @@
+#include "shard_link.h"
+#include <QDataStream>
+#include <QDebug>
+
+namespace {
+enum MessageType : quint8 {
+    MsgHello = 1,       // worker: qint32 region
+    MsgStep = 2,        // coordinator: quint64 step, double dt, QVector<HandoffVehicle>
+    MsgStepDone = 3,    // worker: quint64 step, qint64 live vehicles, QVector<HandoffVehicle>
+    MsgShutdown = 4     // coordinator: no fields
+};
+
+// Every message travels as one QByteArray, i.e. a quint32 length followed
+// by the payload, so the reader can wait for whole records with a transaction
+void sendMessage(QLocalSocket* socket, const QByteArray& payload)
+{
+    QDataStream out(socket);
+    out.setVersion(QDataStream::Qt_6_0);
+    out << payload;
+}
+
+// Calls handle(payload) for every complete message buffered on the socket
+template <typename Handle>
+void drainMessages(QLocalSocket* socket, Handle handle)
+{
+    QDataStream in(socket);
+    in.setVersion(QDataStream::Qt_6_0);
+
+    for (;;) {
+        in.startTransaction();
+        QByteArray payload;
+        in >> payload;
+        if (!in.commitTransaction())
+            return;
+        handle(payload);
+    }
+}
+}
+
+QDataStream& operator<<(QDataStream& out, const HandoffVehicle& vehicle)
+{
+    return out << vehicle.route << vehicle.speed << vehicle.color;
+}
+
+QDataStream& operator>>(QDataStream& in, HandoffVehicle& vehicle)
+{
+    return in >> vehicle.route >> vehicle.speed >> vehicle.color;
+}
+
+// ----------------------------------------------------------------------
+// ShardCoordinator
+// ----------------------------------------------------------------------
+
+ShardCoordinator::ShardCoordinator(const GraphPartition* p, QObject* parent)
+    : QObject(parent),
+    partition(p),
+    shards(p->regionCount(), nullptr),
+    inbox(p->regionCount()),
+    stepSeconds(0.05),
+    stepNumber(0),
+    stepInFlight(false),
+    pendingAcks(0),
+    stepHandoffs(0),
+    stepVehicles(0),
+    stalled(0)
+{
+    stepTimer.setInterval(50);
+    connect(&stepTimer, &QTimer::timeout, this, &ShardCoordinator::beginStep);
+    connect(&server, &QLocalServer::newConnection, this, &ShardCoordinator::acceptConnection);
+}
+
+ShardCoordinator::~ShardCoordinator()
+{
+    QByteArray payload;
+    QDataStream(&payload, QIODevice::WriteOnly) << quint8(MsgShutdown);
+    for (QLocalSocket* socket : shards) {
+        if (socket && socket->state() == QLocalSocket::ConnectedState) {
+            sendMessage(socket, payload);
+            socket->flush();
+        }
+    }
+}
+
+bool ShardCoordinator::listen(const QString& serverName)
+{
+    // A stale socket file from a crashed run would make listen() fail
+    QLocalServer::removeServer(serverName);
+    if (!server.listen(serverName)) {
+        qWarning() << "Shard coordinator cannot listen on" << serverName << server.errorString();
+        return false;
+    }
+    return true;
+}
+
+void ShardCoordinator::setStepInterval(int ms, double simulatedSeconds)
+{
+    stepTimer.setInterval(ms);
+    stepSeconds = simulatedSeconds;
+}
+
+int ShardCoordinator::connectedCount() const
+{
+    int count = 0;
+    for (QLocalSocket* socket : shards) {
+        if (socket)
+            count++;
+    }
+    return count;
+}
+
+void ShardCoordinator::acceptConnection()
+{
+    while (QLocalSocket* socket = server.nextPendingConnection()) {
+        socket->setParent(this);
+        connect(socket, &QLocalSocket::readyRead, this, [this, socket]() {
+            readMessages(socket);
+        });
+        connect(socket, &QLocalSocket::disconnected, this, [this, socket]() {
+            int region = regionOfSocket.value(socket, -1);
+            if (region < 0)
+                return;
+
+            // The barrier can never complete again without this shard
+            qWarning() << "Shard" << region << "disconnected, stopping the simulation";
+            stepTimer.stop();
+            shards[region] = nullptr;
+            regionOfSocket.remove(socket);
+            socket->deleteLater();
+            emit shardLost(region);
+        });
+    }
+}
+
+void ShardCoordinator::readMessages(QLocalSocket* socket)
+{
+    drainMessages(socket, [this, socket](const QByteArray& payload) {
+        handleMessage(socket, payload);
+    });
+}
+
+void ShardCoordinator::handleMessage(QLocalSocket* socket, const QByteArray& payload)
+{
+    QDataStream in(payload);
+    in.setVersion(QDataStream::Qt_6_0);
+
+    quint8 type;
+    in >> type;
+
+    if (type == MsgHello) {
+        qint32 region;
+        in >> region;
+        if (region < 0 || region >= shards.size() || shards[region]) {
+            qWarning() << "Rejecting shard with region" << region;
+            socket->disconnectFromServer();
+            return;
+        }
+
+        shards[region] = socket;
+        regionOfSocket.insert(socket, region);
+        qDebug() << "Shard" << region << "connected," << connectedCount() << "of" << shards.size();
+
+        if (connectedCount() == shards.size()) {
+            emit allShardsConnected();
+            stepTimer.start();
+        }
+        return;
+    }
+
+    if (type != MsgStepDone)
+        return;
+
+    quint64 step;
+    qint64 liveVehicles;
+    QVector<HandoffVehicle> leaving;
+    in >> step >> liveVehicles >> leaving;
+    if (in.status() != QDataStream::Ok || step != stepNumber || !stepInFlight)
+        return;
+
+    // Route each vehicle to the region that owns the edge it entered
+    for (const HandoffVehicle& vehicle : leaving) {
+        int target = partition->regionOf(vehicle.route.value(0));
+        if (target >= 0)
+            inbox[target].append(vehicle);
+    }
+    stepHandoffs += leaving.size();
+    stepVehicles += liveVehicles;
+
+    if (--pendingAcks > 0)
+        return;
+
+    stepInFlight = false;
+    barrierWait.record(barrierClock.nsecsElapsed() / 1000);
+    emit stepCompleted(stepNumber, stepHandoffs, stepVehicles);
+}
+
+void ShardCoordinator::beginStep()
+{
+    // A slow shard holds everybody back rather than letting regions drift
+    if (stepInFlight) {
+        stalled++;
+        return;
+    }
+
+    stepNumber++;
+    stepInFlight = true;
+    pendingAcks = shards.size();
+    stepHandoffs = 0;
+    stepVehicles = 0;
+    barrierClock.start();
+
+    for (int region = 0; region < shards.size(); ++region) {
+        QByteArray payload;
+        QDataStream out(&payload, QIODevice::WriteOnly);
+        out.setVersion(QDataStream::Qt_6_0);
+        out << quint8(MsgStep) << stepNumber << stepSeconds << inbox[region];
+        inbox[region].clear();
+
+        sendMessage(shards[region], payload);
+    }
+}
+
+// ----------------------------------------------------------------------
+// ShardWorker
+// ----------------------------------------------------------------------
+
+ShardWorker::ShardWorker(TrafficSimulator* sim, int r, QObject* parent)
+    : QObject(parent),
+    simulator(sim),
+    region(r)
+{
+    connect(&socket, &QLocalSocket::readyRead, this, &ShardWorker::readMessages);
+    connect(&socket, &QLocalSocket::disconnected, this, &ShardWorker::disconnected);
+    connect(&socket, &QLocalSocket::connected, this, [this]() {
+        QByteArray payload;
+        QDataStream out(&payload, QIODevice::WriteOnly);
+        out.setVersion(QDataStream::Qt_6_0);
+        out << quint8(MsgHello) << qint32(region);
+        sendMessage(&socket, payload);
+        emit connected();
+    });
+    connect(&socket, &QLocalSocket::errorOccurred, this, [this](QLocalSocket::LocalSocketError) {
+        qWarning() << "Shard" << region << "link error:" << socket.errorString();
+        emit disconnected();
+    });
+}
+
+void ShardWorker::connectTo(const QString& serverName)
+{
+    socket.connectToServer(serverName);
+}
+
+void ShardWorker::readMessages()
+{
+    drainMessages(&socket, [this](const QByteArray& payload) {
+        handleMessage(payload);
+    });
+}
+
+void ShardWorker::handleMessage(const QByteArray& payload)
+{
+    QDataStream in(payload);
+    in.setVersion(QDataStream::Qt_6_0);
+
+    quint8 type;
+    in >> type;
+
+    if (type == MsgShutdown) {
+        socket.disconnectFromServer();
+        return;
+    }
+    if (type != MsgStep)
+        return;
+
+    quint64 step;
+    double deltaTime;
+    QVector<HandoffVehicle> arriving;
+    in >> step >> deltaTime >> arriving;
+    if (in.status() != QDataStream::Ok)
+        return;
+
+    simulator->acceptHandoffs(arriving);
+    simulator->step(deltaTime);
+
+    QByteArray reply;
+    QDataStream out(&reply, QIODevice::WriteOnly);
+    out.setVersion(QDataStream::Qt_6_0);
+    out << quint8(MsgStepDone) << step << qint64(simulator->liveVehicleCount())
+        << simulator->takeHandoffs();
+    sendMessage(&socket, reply);
+}
@@ -0,0 +1,101 @@
+#ifndef SHARD_LINK_H
+#define SHARD_LINK_H
+
+#include <QObject>
+#include <QTimer>
+#include <QVector>
+#include <QHash>
+#include <QElapsedTimer>
+#include <QLocalServer>
+#include <QLocalSocket>
+#include "graph_partition.h"
+#include "traffic_simulator.h"
+#include "simulation_metrics.h"
+
+// Sharded simulation over local sockets. One coordinator process owns the
+// clock; each worker process runs a TrafficSimulator restricted to one
+// region of a GraphPartition. Every step is a barrier:
+//
+//   coordinator -> all workers   Step(n, dt, vehicles handed to this region)
+//   worker -> coordinator        StepDone(n, vehicles leaving this region)
+//
+// Step n+1 is only sent once every worker has acknowledged step n, so
+// shards never drift apart. Vehicles leaving a region during step n are
+// adopted by their new region at the start of step n+1.
+//
+// Messages are length-prefixed QDataStream records, so the same framing
+// would work over a QTcpSocket for shards on other hosts.
+
+QDataStream& operator<<(QDataStream& out, const HandoffVehicle& vehicle);
+QDataStream& operator>>(QDataStream& in, HandoffVehicle& vehicle);
+
+class ShardCoordinator : public QObject
+{
+    Q_OBJECT
+public:
+    explicit ShardCoordinator(const GraphPartition* partition, QObject* parent = nullptr);
+    ~ShardCoordinator();
+
+    bool listen(const QString& serverName);
+    void setStepInterval(int ms, double simulatedSeconds);
+
+    quint64 stepCount() const { return stepNumber; }
+    quint64 stalledTicks() const { return stalled; }     // timer fired inside a barrier
+    const LatencyHistogram& barrierLatency() const { return barrierWait; }
+
+signals:
+    void allShardsConnected();
+    void stepCompleted(quint64 step, int handoffs, qint64 liveVehicles);
+    void shardLost(int region);
+
+private slots:
+    void acceptConnection();
+    void readMessages(QLocalSocket* socket);
+    void beginStep();
+
+private:
+    const GraphPartition* partition;
+    QLocalServer server;
+    QVector<QLocalSocket*> shards;            // by region, null until Hello
+    QHash<QLocalSocket*, int> regionOfSocket;
+    QVector<QVector<HandoffVehicle>> inbox;   // by region, sent with the next step
+
+    QTimer stepTimer;
+    double stepSeconds;
+    quint64 stepNumber;
+    bool stepInFlight;
+    int pendingAcks;
+    int stepHandoffs;
+    qint64 stepVehicles;
+    quint64 stalled;
+    QElapsedTimer barrierClock;
+    LatencyHistogram barrierWait;
+
+    int connectedCount() const;
+    void handleMessage(QLocalSocket* socket, const QByteArray& payload);
+};
+
+class ShardWorker : public QObject
+{
+    Q_OBJECT
+public:
+    ShardWorker(TrafficSimulator* simulator, int region, QObject* parent = nullptr);
+
+    void connectTo(const QString& serverName);
+
+signals:
+    void connected();
+    void disconnected();
+
+private slots:
+    void readMessages();
+
+private:
+    TrafficSimulator* simulator;
+    int region;
+    QLocalSocket socket;
+
+    void handleMessage(const QByteArray& payload);
+};
+
+#endif // SHARD_LINK_H
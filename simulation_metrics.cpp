@@ -0,0 +1,242 @@
+#include "simulation_metrics.h"
+#include <QSaveFile>
+#include <QJsonObject>
+#include <QJsonDocument>
+#include <QtAlgorithms>
+
+// ----------------------------------------------------------------------
+// LatencyHistogram
+// ----------------------------------------------------------------------
+
+void LatencyHistogram::reset()
+{
+    buckets.fill(0);
+    total = 0;
+    sumMicros = 0;
+    maxMicros = 0;
+}
+
+int LatencyHistogram::bucketIndex(qint64 micros)
+{
+    if (micros < SubBuckets) {
+        return micros < 0 ? 0 : int(micros);
+    }
+
+    // Magnitude m such that 2^m <= micros < 2^(m+1), m >= 4
+    int m = 63 - qCountLeadingZeroBits(quint64(micros));
+    if (m >= MaxMagnitude) {
+        return BucketCount - 1;
+    }
+
+    int sub = int(micros >> (m - 4)) - SubBuckets;
+    return (m - 3) * SubBuckets + sub;
+}
+
+qint64 LatencyHistogram::bucketUpperBound(int index)
+{
+    if (index < SubBuckets) {
+        return index + 1;
+    }
+
+    int m = index / SubBuckets + 3;
+    int sub = index % SubBuckets;
+    return qint64(SubBuckets + sub + 1) << (m - 4);
+}
+
+void LatencyHistogram::record(qint64 micros)
+{
+    buckets[bucketIndex(micros)]++;
+    total++;
+    sumMicros += micros;
+    if (micros > maxMicros) {
+        maxMicros = micros;
+    }
+}
+
+qint64 LatencyHistogram::percentile(double p) const
+{
+    if (total == 0) {
+        return 0;
+    }
+
+    quint64 target = quint64(qBound(0.0, p, 100.0) / 100.0 * double(total));
+    if (target == 0) {
+        target = 1;
+    }
+
+    quint64 seen = 0;
+    for (int i = 0; i < BucketCount; ++i) {
+        seen += buckets[i];
+        if (seen >= target) {
+            return qMin(bucketUpperBound(i), maxMicros);
+        }
+    }
+    return maxMicros;
+}
+
+// ----------------------------------------------------------------------
+// SimulationMetrics
+// ----------------------------------------------------------------------
+
+SimulationMetrics::SimulationMetrics()
+{
+    reset();
+}
+
+void SimulationMetrics::reset()
+{
+    for (LatencyHistogram& h : histograms) {
+        h.reset();
+    }
+    lastNanos.fill(0);
+    tickOverruns = 0;
+    frameOverruns = 0;
+    droppedSeconds = 0.0;
+
+    vehiclesActive = 0;
+    vehiclesQueued = 0;
+    vehiclesArrived = 0;
+    routesComputed = 0;
+    routeCacheHits = 0;
+}
+
+void SimulationMetrics::recordPhase(Phase phase, qint64 nanos)
+{
+    lastNanos[phase] = nanos;
+    histograms[phase].record(nanos / 1000);
+}
+
+void SimulationMetrics::recordTick(qint64 nanos, qint64 budgetNanos)
+{
+    recordPhase(PhaseTick, nanos);
+    if (budgetNanos > 0 && nanos > budgetNanos) {
+        tickOverruns++;
+    }
+}
+
+void SimulationMetrics::recordFrame(qint64 nanos, qint64 budgetNanos, double dropped)
+{
+    recordPhase(PhaseFrame, nanos);
+    if (budgetNanos > 0 && nanos > budgetNanos) {
+        frameOverruns++;
+    }
+    droppedSeconds += dropped;
+}
+
+const char* SimulationMetrics::phaseName(Phase phase)
+{
+    switch (phase) {
+    case PhaseLights:   return "lights";
+    case PhaseQueues:   return "queues";
+    case PhaseVehicles: return "vehicles";
+    case PhaseRouting:  return "routing";
+    case PhaseReroute:  return "reroute";
+    case PhaseSpawn:    return "spawn";
+    case PhaseEmit:     return "emit";
+    case PhaseTick:     return "tick";
+    case PhaseFrame:    return "frame";
+    default:            return "unknown";
+    }
+}
+
+QByteArray SimulationMetrics::toPrometheus() const
+{
+    QByteArray out;
+
+    out += "# HELP traffic_sim_phase_seconds Time spent per simulation phase.\n";
+    out += "# TYPE traffic_sim_phase_seconds histogram\n";
+    for (int p = 0; p < PhaseCount; ++p) {
+        const LatencyHistogram& h = histograms[p];
+        const QByteArray label = QByteArray("phase=\"") + phaseName(Phase(p)) + "\"";
+
+        // Only non-empty buckets are emitted; Prometheus accepts sparse "le" bounds
+        quint64 cumulative = 0;
+        for (int i = 0; i < LatencyHistogram::BucketCount; ++i) {
+            if (h.bucketValue(i) == 0) {
+                continue;
+            }
+            cumulative += h.bucketValue(i);
+            out += "traffic_sim_phase_seconds_bucket{" + label + ",le=\""
+                   + QByteArray::number(LatencyHistogram::bucketUpperBound(i) / 1e6, 'g', 9)
+                   + "\"} " + QByteArray::number(cumulative) + "\n";
+        }
+        out += "traffic_sim_phase_seconds_bucket{" + label + ",le=\"+Inf\"} "
+               + QByteArray::number(h.count()) + "\n";
+        out += "traffic_sim_phase_seconds_sum{" + label + "} "
+               + QByteArray::number(h.sum() / 1e6, 'g', 12) + "\n";
+        out += "traffic_sim_phase_seconds_count{" + label + "} "
+               + QByteArray::number(h.count()) + "\n";
+    }
+
+    auto gauge = [&out](const char* name, const char* help, const char* type, qint64 value) {
+        out += QByteArray("# HELP ") + name + " " + help + "\n";
+        out += QByteArray("# TYPE ") + name + " " + type + "\n";
+        out += QByteArray(name) + " " + QByteArray::number(value) + "\n";
+    };
+
+    gauge("traffic_sim_tick_overruns_total", "Ticks that exceeded the timer interval.",
+          "counter", qint64(tickOverruns));
+    gauge("traffic_sim_frame_overruns_total", "Frames that exceeded the timer interval.",
+          "counter", qint64(frameOverruns));
+    out += "# HELP traffic_sim_dropped_seconds_total Simulated time skipped by capped catch-up.\n";
+    out += "# TYPE traffic_sim_dropped_seconds_total counter\n";
+    out += "traffic_sim_dropped_seconds_total " + QByteArray::number(droppedSeconds, 'g', 12) + "\n";
+    gauge("traffic_sim_vehicles_active", "Vehicles still travelling.", "gauge", vehiclesActive);
+    gauge("traffic_sim_vehicles_queued", "Vehicles waiting in light queues.", "gauge", vehiclesQueued);
+    gauge("traffic_sim_vehicles_arrived_total", "Vehicles that reached their destination.",
+          "counter", vehiclesArrived);
+    gauge("traffic_sim_routes_computed_total", "Shortest-path searches run.",
+          "counter", routesComputed);
+    gauge("traffic_sim_route_cache_hits_total",
+          "Route requests answered without a search (unreachable pairs).",
+          "counter", routeCacheHits);
+
+    return out;
+}
+
+QByteArray SimulationMetrics::toJson() const
+{
+    QJsonObject phases;
+    for (int p = 0; p < PhaseCount; ++p) {
+        const LatencyHistogram& h = histograms[p];
+        QJsonObject phase;
+        phase["count"] = double(h.count());
+        phase["last_us"] = double(lastNanos[p] / 1000);
+        phase["mean_us"] = h.mean();
+        phase["p50_us"] = double(h.percentile(50.0));
+        phase["p90_us"] = double(h.percentile(90.0));
+        phase["p99_us"] = double(h.percentile(99.0));
+        phase["p999_us"] = double(h.percentile(99.9));
+        phase["max_us"] = double(h.max());
+        phases[QString::fromLatin1(phaseName(Phase(p)))] = phase;
+    }
+
+    QJsonObject counters;
+    counters["tick_overruns"] = double(tickOverruns);
+    counters["frame_overruns"] = double(frameOverruns);
+    counters["dropped_seconds"] = droppedSeconds;
+    counters["vehicles_active"] = double(vehiclesActive);
+    counters["vehicles_queued"] = double(vehiclesQueued);
+    counters["vehicles_arrived"] = double(vehiclesArrived);
+    counters["routes_computed"] = double(routesComputed);
+    counters["route_cache_hits"] = double(routeCacheHits);
+
+    QJsonObject root;
+    root["phases"] = phases;
+    root["counters"] = counters;
+
+    return QJsonDocument(root).toJson(QJsonDocument::Compact);
+}
+
+bool SimulationMetrics::writeTo(const QString& filePath, Format format) const
+{
+    // QSaveFile writes to a temporary and renames, so a scraper never
+    // observes a half-written file
+    QSaveFile file(filePath);
+    if (!file.open(QIODevice::WriteOnly)) {
+        return false;
+    }
+
+    file.write(format == Json ? toJson() : toPrometheus());
+    return file.commit();
+}
@@ -0,0 +1,113 @@
+#ifndef SIMULATION_METRICS_H
+#define SIMULATION_METRICS_H
+
+#include <QtGlobal>
+#include <QString>
+#include <QByteArray>
+#include <array>
+
+// Log-linear latency histogram in the style of HdrHistogram: values are
+// bucketed by their power of two, and each power of two is split into
+// 16 linear sub-buckets, so every bucket is within ~6% of its true value.
+// Values are recorded in microseconds; recording is O(1) and allocation free.
+class LatencyHistogram
+{
+public:
+    static const int SubBuckets = 16;
+    static const int MaxMagnitude = 36;  // 2^36 us (~19 h) is the largest bucket
+    static const int BucketCount = (MaxMagnitude - 3) * SubBuckets;
+
+    LatencyHistogram() { reset(); }
+
+    void record(qint64 micros);
+    void reset();
+
+    quint64 count() const { return total; }
+    qint64 sum() const { return sumMicros; }
+    qint64 max() const { return maxMicros; }
+    double mean() const { return total ? double(sumMicros) / double(total) : 0.0; }
+    qint64 percentile(double p) const;  // p in [0, 100], returns bucket upper bound
+
+    quint64 bucketValue(int index) const { return buckets[index]; }
+    static int bucketIndex(qint64 micros);
+    static qint64 bucketUpperBound(int index);  // exclusive
+
+private:
+    std::array<quint64, BucketCount> buckets;
+    quint64 total;
+    qint64 sumMicros;
+    qint64 maxMicros;
+};
+
+// Per-tick instrumentation of TrafficSimulator: phase timings, a tick
+// latency histogram per phase, and vehicle / routing counters.
+class SimulationMetrics
+{
+public:
+    enum Phase {
+        PhaseLights = 0,
+        PhaseQueues,
+        PhaseVehicles,
+        PhaseRouting,    // periodic edge weight refresh
+        PhaseReroute,    // deferred: budgeted re-routing
+        PhaseSpawn,      // deferred: routing and adding demand departures
+        PhaseEmit,
+        PhaseTick,       // one fixed simulation step
+        PhaseFrame,      // whole timer frame: catch-up steps, deferred work, emit
+        PhaseCount
+    };
+
+    enum Format {
+        Prometheus,
+        Json
+    };
+
+    SimulationMetrics();
+
+    void reset();
+
+    // Recording (called by the simulator)
+    void recordPhase(Phase phase, qint64 nanos);
+    void recordTick(qint64 nanos, qint64 budgetNanos);
+    void recordFrame(qint64 nanos, qint64 budgetNanos, double droppedSeconds);
+    void setVehiclesActive(qint64 n) { vehiclesActive = n; }
+    void setVehiclesQueued(qint64 n) { vehiclesQueued = n; }
+    void addVehiclesArrived(qint64 n = 1) { vehiclesArrived += n; }
+    void addRoutesComputed(qint64 n = 1) { routesComputed += n; }
+    void addRouteCacheHits(qint64 n = 1) { routeCacheHits += n; }
+
+    // Pull API
+    const LatencyHistogram& histogram(Phase phase) const { return histograms[phase]; }
+    qint64 lastPhaseNanos(Phase phase) const { return lastNanos[phase]; }
+    quint64 tickCount() const { return histograms[PhaseTick].count(); }
+    quint64 tickOverrunCount() const { return tickOverruns; }
+    quint64 frameOverrunCount() const { return frameOverruns; }
+    double getDroppedSeconds() const { return droppedSeconds; }
+    qint64 getVehiclesActive() const { return vehiclesActive; }
+    qint64 getVehiclesQueued() const { return vehiclesQueued; }
+    qint64 getVehiclesArrived() const { return vehiclesArrived; }
+    qint64 getRoutesComputed() const { return routesComputed; }
+    qint64 getRouteCacheHits() const { return routeCacheHits; }
+
+    // Export
+    QByteArray toPrometheus() const;
+    QByteArray toJson() const;
+    bool writeTo(const QString& filePath, Format format) const;
+
+    static const char* phaseName(Phase phase);
+
+private:
+    std::array<LatencyHistogram, PhaseCount> histograms;
+    std::array<qint64, PhaseCount> lastNanos;
+    quint64 tickOverruns;
+    quint64 frameOverruns;
+    double droppedSeconds;      // simulated time skipped when catch-up was capped
+
+    qint64 vehiclesActive;
+    qint64 vehiclesQueued;
+    qint64 vehiclesArrived;
+    qint64 routesComputed;
+    qint64 routeCacheHits;
+};
+
+#endif // SIMULATION_METRICS_H
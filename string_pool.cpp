@@ -0,0 +1,81 @@
+#include "string_pool.h"
+
+StringPool::StringPool()
+{
+    strings.append(QString());  // handle 0
+}
+
+StringPool& StringPool::global()
+{
+    static StringPool pool;
+    return pool;
+}
+
+// Lookups hash the view directly and compare against the pooled strings,
+// so interning a string that is already present does not allocate
+StringPool::Handle StringPool::findLocked(QStringView str, size_t hash) const
+{
+    for (auto it = lookup.constFind(hash); it != lookup.constEnd() && it.key() == hash; ++it) {
+        if (QStringView(strings[it.value()]) == str) {
+            return it.value();
+        }
+    }
+    return Empty;
+}
+
+StringPool::Handle StringPool::intern(QStringView str)
+{
+    if (str.isEmpty()) {
+        return Empty;
+    }
+
+    const size_t hash = qHash(str);
+    {
+        QReadLocker locker(&lock);
+        Handle handle = findLocked(str, hash);
+        if (handle != Empty) {
+            return handle;
+        }
+    }
+
+    QWriteLocker locker(&lock);
+
+    // Another thread may have interned it between the two locks
+    Handle handle = findLocked(str, hash);
+    if (handle != Empty) {
+        return handle;
+    }
+
+    handle = Handle(strings.size());
+    strings.append(str.toString());
+    lookup.insert(hash, handle);
+    return handle;
+}
+
+StringPool::Handle StringPool::find(QStringView str) const
+{
+    if (str.isEmpty()) {
+        return Empty;
+    }
+
+    QReadLocker locker(&lock);
+    return findLocked(str, qHash(str));
+}
+
+QStringView StringPool::view(Handle handle) const
+{
+    QReadLocker locker(&lock);
+    if (handle >= quint32(strings.size())) {
+        return QStringView();
+    }
+
+    // The character data is owned by the pooled QString and never freed,
+    // even when the vector holding the QString objects reallocates
+    return QStringView(strings[handle]);
+}
+
+int StringPool::size() const
+{
+    QReadLocker locker(&lock);
+    return strings.size();
+}
@@ -0,0 +1,46 @@
+#ifndef STRING_POOL_H
+#define STRING_POOL_H
+
+#include <QtGlobal>
+#include <QString>
+#include <QStringView>
+#include <QVector>
+#include <QHash>
+#include <QReadWriteLock>
+
+// Process-wide pool of interned strings. Each distinct string is stored
+// once and referred to by a 32-bit handle; handle 0 is the empty string.
+// Interned strings are never released, so views stay valid for the
+// lifetime of the process. All methods are thread-safe.
+//
+// The growth is intended: a map loaded in the background interns its
+// names while the previous graph (and any view taken from it) is still
+// in use, so nothing can be dropped at swap time. Reloading the same or
+// an overlapping map reuses the existing entries; only names new to the
+// process add to the pool.
+class StringPool
+{
+public:
+    typedef quint32 Handle;
+    static const Handle Empty = 0;
+
+    static StringPool& global();
+
+    Handle intern(QStringView str);
+    Handle find(QStringView str) const;   // Empty if not interned
+    QStringView view(Handle handle) const;
+    QString string(Handle handle) const { return view(handle).toString(); }
+    int size() const;
+
+private:
+    StringPool();
+    Q_DISABLE_COPY(StringPool)
+
+    QVector<QString> strings;              // handle -> string
+    QMultiHash<size_t, Handle> lookup;     // qHash of the string -> candidate handles
+    mutable QReadWriteLock lock;
+
+    Handle findLocked(QStringView str, size_t hash) const;
+};
+
+#endif // STRING_POOL_H
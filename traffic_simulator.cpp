@@ -2,62 +2,472 @@
 #include <QtMath>
 #include <QDebug>
 #include <QQueue>
+#include <QDataStream>
+#include <QFile>
+#include <QSaveFile>
+#include <QtConcurrent>
+#include <limits>
+#include <sstream>
+
+namespace {
+// BPR volume-delay function: cost = freeFlow * (1 + ALPHA * (load / capacity)^4)
+const double BPR_ALPHA = 0.15;
+const double VEHICLES_PER_KM = 40.0;      // edge capacity per km of road
+const double REROUTE_THRESHOLD = 1.5;     // congestion factor that triggers re-routing
+
+// Frame scheduling
+const int DEFAULT_MAX_CATCH_UP_STEPS = 4; // fixed steps per frame before time is dropped
+const double STEP_SLACK = 0.1;            // a step may start this share early to absorb timer jitter
+const double DEFERRED_SHARE = 0.8;        // deferred work stops at this share of the frame budget
+const int SPAWN_SLICE = 64;               // departures routed per slice of deferred work
+
+const quint32 CHECKPOINT_MAGIC = 0x5453434b;  // "TSCK"
+const quint32 CHECKPOINT_VERSION = 3;  // 2: simulation clock and demand state, 3: mt19937 state
+}
 
 TrafficSimulator::TrafficSimulator(Graph* g, QObject* parent)
     : QObject(parent),
     graph(g),
     simulationSpeed(1.0),
-    nextVehicleId(1)
+    simulationTime(0.0),
+    demand(nullptr),
+    pendingTime(0.0),
+    maxCatchUpSteps(DEFAULT_MAX_CATCH_UP_STEPS),
+    rerouteInterval(10.0),
+    rerouteTimer(0.0),
+    rerouteBudget(5),
+    metricsEnabled(false),
+    metricsExportFormat(SimulationMetrics::Prometheus),
+    metricsFlushPending(false),
+    partition(nullptr),
+    region(0)
 {
     connect(&timer, &QTimer::timeout, this, &TrafficSimulator::updateSimulation);
     timer.setInterval(50); // 20 updates/sec (~smooth)
+
+    connect(&metricsExportTimer, &QTimer::timeout, this, &TrafficSimulator::exportMetrics);
+    connect(&checkpointTimer, &QTimer::timeout, this, &TrafficSimulator::autoCheckpoint);
+    connect(&checkpointWatcher, &QFutureWatcher<bool>::finished, this, [this]() {
+        emit checkpointSaved(pendingCheckpointPath, checkpointWatcher.result());
+    });
+}
+
+void TrafficSimulator::start()
+{
+    // The first frame advances by one nominal step
+    wallClock.invalidate();
+    pendingTime = 0.0;
+    timer.start();
 }
 
-void TrafficSimulator::start() { timer.start(); }
 void TrafficSimulator::stop() { timer.stop(); }
 
+void TrafficSimulator::setMaxCatchUpSteps(int steps)
+{
+    maxCatchUpSteps = qMax(1, steps);
+}
+
 void TrafficSimulator::reset() {
-    vehicles.clear();
+    vehiclePool.clear();
+    pathArena.clear();
     trafficLights.clear();
     lightQueues.clear();
     lightReleaseTimers.clear();  // ✅ Added to track queue release timing
-    nextVehicleId = 1;
+    simulationTime = 0.0;
+    pendingTime = 0.0;
+    spawnBacklog.clear();
+    if (demand)
+        demand->rewind();
+    rerouteTimer = 0.0;
+    rerouteQueue.clear();
+    rerouteQueued.clear();
+    congestedEdges.clear();
+    outbox.clear();
+    graph->resetCongestion();
+    simMetrics.reset();
+}
+
+void TrafficSimulator::setRerouteInterval(double seconds)
+{
+    rerouteInterval = seconds;
+    rerouteTimer = 0.0;
+}
+
+void TrafficSimulator::setRerouteBudget(int vehiclesPerTick)
+{
+    rerouteBudget = qMax(0, vehiclesPerTick);
+}
+
+void TrafficSimulator::setMetricsEnabled(bool enabled)
+{
+    metricsEnabled = enabled;
+    if (!enabled) {
+        metricsExportTimer.stop();
+    } else if (!metricsExportPath.isEmpty()) {
+        metricsExportTimer.start();
+    }
+}
+
+// Periodically dump metrics to a file for a local scraper.
+// An empty path or a non-positive interval disables the export.
+void TrafficSimulator::setMetricsExport(const QString& filePath,
+                                        SimulationMetrics::Format format,
+                                        int intervalMs)
+{
+    metricsExportPath = filePath;
+    metricsExportFormat = format;
+
+    if (filePath.isEmpty() || intervalMs <= 0) {
+        metricsExportPath.clear();
+        metricsExportTimer.stop();
+        return;
+    }
+
+    metricsExportTimer.setInterval(intervalMs);
+    if (metricsEnabled) {
+        metricsExportTimer.start();
+    }
 }
 
-void TrafficSimulator::addVehicle(qint64 source, qint64 destination)
+void TrafficSimulator::exportMetrics()
 {
-    if (!graph->hasNode(source) || !graph->hasNode(destination))
+    if (!metricsEnabled || metricsExportPath.isEmpty())
+        return;
+
+    // While running, the write waits for spare time at the end of a frame
+    if (timer.isActive()) {
+        if (!metricsFlushPending) {
+            metricsFlushPending = true;
+            metricsFlushWait.start();
+        }
         return;
+    }
+    flushMetrics();
+}
+
+void TrafficSimulator::flushMetrics()
+{
+    metricsFlushPending = false;
+    if (!simMetrics.writeTo(metricsExportPath, metricsExportFormat))
+        qWarning() << "Failed to write metrics to" << metricsExportPath;
+}
+
+// Cheap checks that rule a trip out before any route search. Pairs in
+// different components are answered without a search and counted as such.
+bool TrafficSimulator::acceptsTrip(qint64 source, qint64 destination)
+{
+    if (!graph->hasNode(source) || !graph->hasNode(destination) || !ownsNode(source))
+        return false;
+
+    if (!graph->mayReach(source, destination)) {
+        simMetrics.addRouteCacheHits();
+        return false;
+    }
+    return true;
+}
+
+qint64 TrafficSimulator::addVehicle(qint64 source, qint64 destination)
+{
+    if (!acceptsTrip(source, destination))
+        return 0;
 
     Graph::PathResult path = graph->dijkstra(source, destination);
+    simMetrics.addRoutesComputed();
     if (!path.found || path.path.size() < 2)
-        return;
+        return 0;
 
-    Vehicle v;
-    v.id = nextVehicleId++;
-    v.path = path.path;
-    v.currentIndex = 0;
+    return spawnVehicle(path.path);
+}
+
+// Routes are searched in parallel on the global thread pool (Graph routing
+// is safe to call concurrently); vehicles are then added in trip order
+int TrafficSimulator::addVehicles(const QVector<QPair<qint64, qint64>>& trips)
+{
+    QVector<QPair<qint64, qint64>> accepted;
+    accepted.reserve(trips.size());
+    for (const auto& trip : trips) {
+        if (acceptsTrip(trip.first, trip.second))
+            accepted.append(trip);
+    }
+    if (accepted.isEmpty())
+        return 0;
+
+    const QVector<QVector<qint64>> paths = QtConcurrent::blockingMapped<QVector<QVector<qint64>>>(
+        accepted, [this](const QPair<qint64, qint64>& trip) {
+            Graph::PathResult result = graph->dijkstra(trip.first, trip.second);
+            return result.found && result.path.size() >= 2 ? result.path : QVector<qint64>();
+        });
+    simMetrics.addRoutesComputed(accepted.size());
+
+    int added = 0;
+    for (const QVector<qint64>& path : paths) {
+        if (!path.isEmpty() && spawnVehicle(path))
+            added++;
+    }
+    return added;
+}
+
+qint64 TrafficSimulator::spawnVehicle(const QVector<qint64>& path)
+{
+    Vehicle& v = vehiclePool.acquire();
+    if (!assignPath(v, path)) {
+        vehiclePool.release(v.id);
+        return 0;
+    }
     v.progress = 0.0;
     v.speed = 10.0 + QRandomGenerator::global()->bounded(5.0);
     v.waitingAtLight = false;
     v.color = QColor::fromHsl(QRandomGenerator::global()->bounded(360), 255, 150);
 
-    const Graph::Node& n = graph->getNode(v.path.first());
+    const Graph::Node& n = graph->getNode(v.fromNode);
     v.position = QPointF(n.lon, n.lat);
 
-    vehicles.append(v);
+    return v.id;
+}
+
+void TrafficSimulator::setDemand(DemandModel* model)
+{
+    demand = model;
+}
+
+// Route and add backlogged departures in slices until the deadline. The
+// first slice always runs, so spawning never starves under load; late
+// departures simply start a little after their scheduled time.
+void TrafficSimulator::spawnDepartures(const QDeadlineTimer& deadline)
+{
+    int done = 0;
+    while (done < spawnBacklog.size() && (done == 0 || !deadline.hasExpired())) {
+        int count = qMin(SPAWN_SLICE, int(spawnBacklog.size()) - done);
+
+        QVector<QPair<qint64, qint64>> trips;
+        trips.reserve(count);
+        for (int i = done; i < done + count; ++i)
+            trips.append(qMakePair(spawnBacklog[i].origin, spawnBacklog[i].destination));
+        addVehicles(trips);
+        done += count;
+    }
+    spawnBacklog.remove(0, done);
 }
 
+// Store a route in the arena and put the vehicle on its first edge.
+// Progress along that edge is left untouched.
+bool TrafficSimulator::assignPath(Vehicle& v, const QVector<qint64>& nodeIds)
+{
+    QVector<int> indices;
+    indices.reserve(nodeIds.size());
+    for (qint64 id : nodeIds) {
+        int index = graph->nodeIndexOf(id);
+        if (index < 0)
+            return false;
+        indices.append(index);
+    }
+
+    pathArena.release(v.path);
+    v.path = pathArena.allocate(indices);
+    v.currentIndex = 0;
+    v.fromNode = nodeIds.first();
+    v.toNode = nodeIds[1];
+    v.toIndex = indices[1];
+    v.destination = nodeIds.last();
+    return true;
+}
+
+void TrafficSimulator::advanceEdge(Vehicle& v)
+{
+    v.currentIndex++;
+    v.fromNode = v.toNode;
+    if (v.hasArrived())
+        return;
+
+    v.toIndex += pathArena.delta(v.path, v.currentIndex + 1);
+    v.toNode = graph->nodeIdAt(v.toIndex);
+}
+
+// Calls visit(from, to) for every edge after the current one, stopping
+// early when visit returns false
+template <typename Visit>
+void TrafficSimulator::forEachRemainingEdge(const Vehicle& v, Visit visit) const
+{
+    qint32 index = v.toIndex;
+    qint64 from = v.toNode;
+    for (int k = v.currentIndex + 2; k < int(v.path.length); ++k) {
+        index += pathArena.delta(v.path, k);
+        qint64 to = graph->nodeIdAt(index);
+        if (!visit(from, to))
+            return;
+        from = to;
+    }
+}
+
+void TrafficSimulator::retireVehicles(const QVector<qint64>& handles)
+{
+    for (qint64 handle : handles) {
+        Vehicle* v = vehiclePool.get(handle);
+        if (!v)
+            continue;
+
+        releaseVehicle(*v);
+        simMetrics.addVehiclesArrived();
+    }
+
+    if (pathArena.needsCompaction())
+        compactPaths();
+}
+
+void TrafficSimulator::releaseVehicle(Vehicle& v)
+{
+    qint64 handle = v.id;
+    pathArena.release(v.path);
+    rerouteQueued.remove(handle);
+    vehiclePool.release(handle);
+}
+
+// Rewrite live routes into a fresh arena, dropping released ones
+void TrafficSimulator::compactPaths()
+{
+    PathArena compacted;
+    for (Vehicle& v : vehiclePool.all()) {
+        if (v.active)
+            v.path = compacted.copyFrom(pathArena, v.path);
+    }
+    pathArena = compacted;
+}
+
+// Timer-driven frame. Simulated time follows measured wall time in fixed
+// steps, with at most maxCatchUpSteps per frame; time beyond that is
+// dropped instead of piling up. Deferred work then gets what is left of
+// the frame budget, and the state is emitted once.
 void TrafficSimulator::updateSimulation()
 {
-    double deltaTime = timer.interval() / 1000.0 * simulationSpeed;
+    QElapsedTimer frameClock;
+    frameClock.start();
+
+    const qint64 budgetNanos = qint64(timer.interval()) * 1000000;
+    const double stepSeconds = timer.interval() / 1000.0 * simulationSpeed;
+
+    qint64 wallNanos = wallClock.isValid() ? wallClock.nsecsElapsed() : budgetNanos;
+    wallClock.start();
+    pendingTime += wallNanos / 1e9 * simulationSpeed;
+
+    int steps = 0;
+    while (steps < maxCatchUpSteps && pendingTime >= stepSeconds * (1.0 - STEP_SLACK)) {
+        simulateStep(stepSeconds, budgetNanos);
+        pendingTime -= stepSeconds;
+        steps++;
+    }
+
+    double dropped = 0.0;
+    if (pendingTime >= stepSeconds) {
+        dropped = pendingTime;
+        pendingTime = 0.0;
+    }
+
+    QDeadlineTimer deadline;
+    deadline.setPreciseRemainingTime(
+        0, qMax<qint64>(0, qint64(budgetNanos * DEFERRED_SHARE) - frameClock.nsecsElapsed()));
+    runDeferredWork(deadline);
+    emitState();
+
+    qint64 frameNanos = frameClock.nsecsElapsed();
+    if (metricsEnabled)
+        simMetrics.recordFrame(frameNanos, budgetNanos, dropped);
+    if (frameNanos > budgetNanos || dropped > 0.0)
+        emit frameOverrun(frameNanos / 1000, dropped);
+}
+
+// One externally clocked step (sharded runs): deferred work runs to
+// completion. The frame timer is idle here, so the tick budget is the wall
+// time the step stands for at the current simulation speed.
+void TrafficSimulator::step(double deltaTime)
+{
+    simulateStep(deltaTime, qint64(deltaTime / qMax(simulationSpeed, 1e-9) * 1e9));
+    runDeferredWork(QDeadlineTimer(QDeadlineTimer::Forever));
+    emitState();
+}
+
+// The phases that must run every step for the simulation to stay correct
+void TrafficSimulator::simulateStep(double deltaTime, qint64 budgetNanos)
+{
+    simulationTime += deltaTime;
+    if (demand)
+        spawnBacklog += demand->takeDue(simulationTime);
+
+    if (!metricsEnabled) {
+        updateTrafficLights(deltaTime);
+        updateQueues(deltaTime);     // 🚦 New: handle queue release timing
+        updateVehicles(deltaTime);
+        updateEdgeWeights(deltaTime);
+        return;
+    }
+
+    // Same sequence as above, with a lap timestamp after each phase
+    phaseClock.start();
+    qint64 lapStart = 0;
 
     updateTrafficLights(deltaTime);
-    updateQueues(deltaTime);     // 🚦 New: handle queue release timing
+    lapPhase(SimulationMetrics::PhaseLights, lapStart);
+    updateQueues(deltaTime);
+    lapPhase(SimulationMetrics::PhaseQueues, lapStart);
     updateVehicles(deltaTime);
+    lapPhase(SimulationMetrics::PhaseVehicles, lapStart);
+    updateEdgeWeights(deltaTime);
+    lapPhase(SimulationMetrics::PhaseRouting, lapStart);
+
+    simMetrics.recordTick(phaseClock.nsecsElapsed(), budgetNanos);
+}
+
+// Work that may lag behind the simulation: queued re-routes, backlogged
+// departures and the metrics file. Re-routing and spawning make some
+// progress every frame even when the deadline has already passed; a
+// metrics write is only forced once it is a full export interval late.
+void TrafficSimulator::runDeferredWork(const QDeadlineTimer& deadline)
+{
+    if (metricsEnabled)
+        phaseClock.start();
+    qint64 lapStart = 0;
+
+    drainReroutes(deadline);
+    if (metricsEnabled)
+        lapPhase(SimulationMetrics::PhaseReroute, lapStart);
+    spawnDepartures(deadline);
+    if (metricsEnabled)
+        lapPhase(SimulationMetrics::PhaseSpawn, lapStart);
 
-    emit vehiclesUpdated(vehicles);
+    if (metricsFlushPending &&
+        (!deadline.hasExpired() || metricsFlushWait.elapsed() >= metricsExportTimer.interval()))
+        flushMetrics();
+}
+
+void TrafficSimulator::emitState()
+{
+    if (metricsEnabled)
+        phaseClock.start();
+
+    emit vehiclesUpdated(vehiclePool.all());
     emit trafficLightsUpdated(trafficLights.values().toVector());
+
+    if (metricsEnabled) {
+        qint64 lapStart = 0;
+        lapPhase(SimulationMetrics::PhaseEmit, lapStart);
+        updateVehicleCounters();
+    }
+}
+
+void TrafficSimulator::lapPhase(SimulationMetrics::Phase phase, qint64& lapStart)
+{
+    qint64 now = phaseClock.nsecsElapsed();
+    simMetrics.recordPhase(phase, now - lapStart);
+    lapStart = now;
+}
+
+void TrafficSimulator::updateVehicleCounters()
+{
+    qint64 queued = 0;
+    for (auto it = lightQueues.cbegin(); it != lightQueues.cend(); ++it)
+        queued += it->size();
+
+    simMetrics.setVehiclesActive(vehiclePool.liveCount());
+    simMetrics.setVehiclesQueued(queued);
 }
 
 void TrafficSimulator::updateTrafficLights(double deltaTime)
@@ -117,16 +527,14 @@ void TrafficSimulator::updateQueues(double deltaTime)
 
         // if enough time passed, release next car
         if (lightReleaseTimers[nodeId] >= RELEASE_INTERVAL) {
-            int releasedId = queue.dequeue();
+            qint64 releasedId = queue.dequeue();
             lightReleaseTimers[nodeId] = 0.0;
 
-            for (Vehicle &v : vehicles) {
-                if (v.id == releasedId) {
-                    v.waitingAtLight = false;
-                    qDebug() << "Vehicle" << v.id << "released from queue at light" << nodeId
-                             << "remaining queue size:" << queue.size();
-                    break;
-                }
+            Vehicle* v = vehiclePool.get(releasedId);
+            if (v) {
+                v->waitingAtLight = false;
+                qDebug() << "Vehicle" << v->id << "released from queue at light" << nodeId
+                         << "remaining queue size:" << queue.size();
             }
         }
     }
@@ -135,15 +543,18 @@ void TrafficSimulator::updateQueues(double deltaTime)
 void TrafficSimulator::updateVehicles(double deltaTime)
 {
     const double MIN_GAP = 0.0002;
+    QVector<Vehicle>& vehicles = vehiclePool.all();
+    QVector<qint64> arrived;
+    QVector<qint64> leaving;
 
     for (int i = 0; i < vehicles.size(); ++i) {
         Vehicle &v = vehicles[i];
 
-        if (v.currentIndex >= v.path.size() - 1)
+        if (!v.active || v.hasArrived())
             continue;
 
-        qint64 from = v.path[v.currentIndex];
-        qint64 to = v.path[v.currentIndex + 1];
+        qint64 from = v.fromNode;
+        qint64 to = v.toNode;
 
         const Graph::Node &n1 = graph->getNode(from);
         const Graph::Node &n2 = graph->getNode(to);
@@ -174,6 +585,7 @@ void TrafficSimulator::updateVehicles(double deltaTime)
         for (int j = 0; j < vehicles.size(); ++j) {
             if (i == j) continue;
             Vehicle &other = vehicles[j];
+            if (!other.active) continue;
             if (other.currentIndex == v.currentIndex && other.progress > v.progress) {
                 double diff = other.progress - v.progress;
                 if (diff < MIN_GAP)
@@ -189,16 +601,487 @@ void TrafficSimulator::updateVehicles(double deltaTime)
         v.progress += (v.speed * deltaTime) / (edgeLength * 1000.0);
         if (v.progress > 1.0) {
             v.progress = 0.0;
-            v.currentIndex++;
-            if (v.currentIndex >= v.path.size() - 1)
+            advanceEdge(v);
+            if (v.hasArrived()) {
+                arrived.append(v.id);
                 continue;
+            }
+            if (!ownsNode(v.fromNode)) {
+                leaving.append(v.id);
+                continue;
+            }
         }
 
         // Update position
-        const Graph::Node &a = graph->getNode(v.path[v.currentIndex]);
-        const Graph::Node &b = graph->getNode(v.path[v.currentIndex + 1]);
+        const Graph::Node &a = graph->getNode(v.fromNode);
+        const Graph::Node &b = graph->getNode(v.toNode);
         v.position = interpolatePosition(a.pos, b.pos, v.progress);
     }
+
+    // Arrivals free their slot and route for reuse
+    handOffVehicles(leaving);
+    retireVehicles(arrived);
+}
+
+void TrafficSimulator::updateEdgeWeights(double deltaTime)
+{
+    if (rerouteInterval > 0.0) {
+        rerouteTimer += deltaTime;
+        if (rerouteTimer >= rerouteInterval) {
+            rerouteTimer = 0.0;
+            refreshEdgeWeights();
+        }
+    }
+}
+
+// Drain the re-route queue within this frame's search budget and deadline.
+// The first search always runs.
+void TrafficSimulator::drainReroutes(const QDeadlineTimer& deadline)
+{
+    int budget = rerouteBudget;
+    while (budget > 0 && !rerouteQueue.isEmpty() &&
+           (budget == rerouteBudget || !deadline.hasExpired())) {
+        qint64 id = rerouteQueue.dequeue();
+        rerouteQueued.remove(id);
+
+        Vehicle* v = vehiclePool.get(id);
+        if (v && rerouteVehicle(*v))
+            budget--;
+    }
+}
+
+// Recompute congestion factors from the number of vehicles currently on each
+// edge, then queue every vehicle whose remaining route crosses a jammed edge.
+void TrafficSimulator::refreshEdgeWeights()
+{
+    const QVector<Vehicle>& vehicles = vehiclePool.all();
+
+    QHash<EdgeKey, int> occupancy;
+    for (const Vehicle& v : vehicles) {
+        if (!v.active || v.hasArrived())
+            continue;
+        occupancy[EdgeKey(v.fromNode, v.toNode)]++;
+    }
+
+    QSet<EdgeKey> nowCongested;
+    QSet<EdgeKey> jammed;
+    for (auto it = occupancy.cbegin(); it != occupancy.cend(); ++it) {
+        const Graph::Edge* edge = graph->findEdge(it.key().first, it.key().second);
+        if (!edge)
+            continue;
+
+        double capacity = qMax(1.0, edge->distance * VEHICLES_PER_KM);
+        double ratio = it.value() / capacity;
+        double factor = 1.0 + BPR_ALPHA * ratio * ratio * ratio * ratio;
+        if (factor <= 1.01)
+            continue;
+
+        graph->setEdgeCongestion(it.key().first, it.key().second, factor);
+        nowCongested.insert(it.key());
+        if (factor >= REROUTE_THRESHOLD)
+            jammed.insert(it.key());
+    }
+
+    // Edges that cleared since the last refresh go back to free flow
+    for (const EdgeKey& key : congestedEdges) {
+        if (!nowCongested.contains(key))
+            graph->setEdgeCongestion(key.first, key.second, 1.0);
+    }
+    congestedEdges = nowCongested;
+
+    if (jammed.isEmpty())
+        return;
+
+    for (const Vehicle& v : vehicles) {
+        if (!v.active || rerouteQueued.contains(v.id))
+            continue;
+
+        // The edge the vehicle is on cannot be avoided any more
+        forEachRemainingEdge(v, [&](qint64 from, qint64 to) {
+            if (!jammed.contains(EdgeKey(from, to)))
+                return true;
+            queueReroute(v.id);
+            return false;
+        });
+    }
+}
+
+void TrafficSimulator::queueReroute(qint64 vehicleId)
+{
+    if (rerouteQueued.contains(vehicleId))
+        return;
+    rerouteQueue.enqueue(vehicleId);
+    rerouteQueued.insert(vehicleId);
+}
+
+void TrafficSimulator::handleEdgesChanged(const QList<Graph::EdgeKey>& edges)
+{
+    if (edges.isEmpty())
+        return;
+
+    QSet<EdgeKey> changed(edges.cbegin(), edges.cend());
+    QVector<qint64> affected;
+
+    for (const Vehicle& v : vehiclePool.all()) {
+        if (!v.active)
+            continue;
+
+        forEachRemainingEdge(v, [&](qint64 from, qint64 to) {
+            if (!changed.contains(EdgeKey(from, to)))
+                return true;
+            affected.append(v.id);
+            queueReroute(v.id);
+            return false;
+        });
+    }
+
+    if (!affected.isEmpty())
+        emit vehiclesAffected(affected);
+}
+
+// Cost of the rest of the route, starting at the end of the current edge
+double TrafficSimulator::remainingCost(const Vehicle& v) const
+{
+    double cost = 0.0;
+    forEachRemainingEdge(v, [&](qint64 from, qint64 to) {
+        const Graph::Edge* edge = graph->findEdge(from, to);
+        if (!edge || edge->closed) {
+            cost = std::numeric_limits<double>::infinity();
+            return false;
+        }
+        cost += edge->distance * edge->congestion;
+        return true;
+    });
+    return cost;
+}
+
+// Re-plan from the next node onwards. The new route starts with the edge
+// the vehicle is on, so the already travelled prefix is dropped from the
+// arena. Returns true if a route search was run.
+bool TrafficSimulator::rerouteVehicle(Vehicle& v)
+{
+    if (v.currentIndex + 1 >= int(v.path.length) - 1)
+        return false;
+
+    Graph::PathResult result = graph->dijkstra(v.toNode, v.destination);
+    simMetrics.addRoutesComputed();
+
+    if (!result.found || result.totalCost >= remainingCost(v) - 1e-9)
+        return true;
+
+    QVector<qint64> route;
+    route.reserve(result.path.size() + 1);
+    route.append(v.fromNode);
+    route += result.path;
+    assignPath(v, route);
+    return true;
+}
+
+// ----------------------------------------------------------------------
+// Sharding
+// ----------------------------------------------------------------------
+
+void TrafficSimulator::setRegion(const GraphPartition* p, int r)
+{
+    partition = p;
+    region = r;
+}
+
+bool TrafficSimulator::ownsNode(qint64 nodeId) const
+{
+    return !partition || partition->regionOf(nodeId) == region;
+}
+
+// Move vehicles that entered another region's edge to the outbox
+void TrafficSimulator::handOffVehicles(const QVector<qint64>& handles)
+{
+    for (qint64 handle : handles) {
+        Vehicle* v = vehiclePool.get(handle);
+        if (!v)
+            continue;
+
+        HandoffVehicle h;
+        h.route.append(v->fromNode);
+        h.route.append(v->toNode);
+        forEachRemainingEdge(*v, [&](qint64, qint64 to) {
+            h.route.append(to);
+            return true;
+        });
+        h.speed = v->speed;
+        h.color = v->color;
+        outbox.append(h);
+
+        releaseVehicle(*v);
+    }
+}
+
+QVector<HandoffVehicle> TrafficSimulator::takeHandoffs()
+{
+    QVector<HandoffVehicle> taken;
+    taken.swap(outbox);
+    return taken;
+}
+
+// Adopt vehicles handed over by neighbouring shards. They start at the
+// beginning of the first edge of their route. Returns the number adopted.
+int TrafficSimulator::acceptHandoffs(const QVector<HandoffVehicle>& vehicles)
+{
+    int adopted = 0;
+    for (const HandoffVehicle& h : vehicles) {
+        if (h.route.size() < 2)
+            continue;
+
+        Vehicle& v = vehiclePool.acquire();
+        if (!assignPath(v, h.route)) {
+            vehiclePool.release(v.id);
+            continue;
+        }
+        v.progress = 0.0;
+        v.speed = h.speed;
+        v.waitingAtLight = false;
+        v.color = h.color;
+
+        const Graph::Node& n = graph->getNode(v.fromNode);
+        v.position = QPointF(n.lon, n.lat);
+        adopted++;
+    }
+    return adopted;
+}
+
+// ----------------------------------------------------------------------
+// Checkpoints
+// ----------------------------------------------------------------------
+
+void TrafficSimulator::setAutoCheckpoint(const QString& filePath, int intervalMs)
+{
+    autoCheckpointPath = filePath;
+    if (filePath.isEmpty() || intervalMs <= 0) {
+        checkpointTimer.stop();
+        return;
+    }
+    checkpointTimer.start(intervalMs);
+}
+
+void TrafficSimulator::autoCheckpoint()
+{
+    saveCheckpoint(autoCheckpointPath);
+}
+
+TrafficSimulator::Checkpoint TrafficSimulator::captureCheckpoint() const
+{
+    // All members below are implicitly shared, so this is a handful of
+    // reference count increments regardless of the number of vehicles
+    Checkpoint cp;
+    cp.graphLayout = graph->layoutHash();
+    cp.simulationSpeed = simulationSpeed;
+    cp.vehicles = vehiclePool;
+    cp.paths = pathArena;
+    cp.lights = trafficLights;
+    cp.queues = lightQueues;
+    cp.releaseTimers = lightReleaseTimers;
+    cp.rerouteInterval = rerouteInterval;
+    cp.rerouteTimer = rerouteTimer;
+    cp.rerouteBudget = rerouteBudget;
+    cp.rerouteQueue = rerouteQueue;
+
+    for (const EdgeKey& key : congestedEdges) {
+        const Graph::Edge* edge = graph->findEdge(key.first, key.second);
+        if (edge)
+            cp.congestion.append(qMakePair(key, edge->congestion));
+    }
+
+    cp.simulationTime = simulationTime;
+    cp.spawnBacklog = spawnBacklog;
+    cp.hasDemand = demand != nullptr;
+    if (demand)
+        cp.demand = demand->capture();
+    return cp;
+}
+
+void TrafficSimulator::saveCheckpoint(const QString& filePath)
+{
+    if (checkpointWatcher.isRunning()) {
+        qWarning() << "Checkpoint still being written, skipping" << filePath;
+        return;
+    }
+
+    pendingCheckpointPath = filePath;
+    checkpointWatcher.setFuture(QtConcurrent::run(&TrafficSimulator::writeCheckpoint,
+                                                  captureCheckpoint(), filePath));
+}
+
+namespace {
+
+void writeDepartures(QDataStream& out, const QVector<DemandModel::Departure>& departures)
+{
+    out << qint32(departures.size());
+    for (const DemandModel::Departure& departure : departures)
+        out << departure.time << departure.origin << departure.destination;
+}
+
+void readDepartures(QDataStream& in, QVector<DemandModel::Departure>& departures)
+{
+    qint32 count;
+    in >> count;
+    for (qint32 i = 0; i < count && in.status() == QDataStream::Ok; ++i) {
+        DemandModel::Departure departure;
+        in >> departure.time >> departure.origin >> departure.destination;
+        departures.append(departure);
+    }
+}
+
+}
+
+bool TrafficSimulator::writeCheckpoint(const Checkpoint& cp, const QString& filePath)
+{
+    QSaveFile file(filePath);
+    if (!file.open(QIODevice::WriteOnly))
+        return false;
+
+    QDataStream out(&file);
+    out.setVersion(QDataStream::Qt_6_0);
+
+    out << CHECKPOINT_MAGIC << CHECKPOINT_VERSION << cp.graphLayout << cp.simulationSpeed;
+
+    cp.vehicles.save(out);
+    cp.paths.save(out);
+
+    out << qint32(cp.lights.size());
+    for (const TrafficLight& light : cp.lights)
+        out << light.nodeId << light.isGreen << light.timer << light.cycleDuration;
+
+    out << qint32(cp.queues.size());
+    for (auto it = cp.queues.cbegin(); it != cp.queues.cend(); ++it)
+        out << it.key() << QList<qint64>(it.value());
+
+    out << cp.releaseTimers;
+    out << cp.rerouteInterval << cp.rerouteTimer << qint32(cp.rerouteBudget)
+        << QList<qint64>(cp.rerouteQueue);
+
+    out << qint32(cp.congestion.size());
+    for (const auto& entry : cp.congestion)
+        out << entry.first.first << entry.first.second << entry.second;
+
+    out << cp.simulationTime;
+    writeDepartures(out, cp.spawnBacklog);
+    out << cp.hasDemand;
+    if (cp.hasDemand) {
+        std::ostringstream rngState;
+        rngState << cp.demand.rng;
+        out << QByteArray::fromStdString(rngState.str()) << cp.demand.generatedUntil;
+        writeDepartures(out, cp.demand.pending);
+    }
+
+    if (out.status() != QDataStream::Ok)
+        return false;
+    return file.commit();
+}
+
+bool TrafficSimulator::readCheckpoint(Checkpoint& cp, const QString& filePath)
+{
+    QFile file(filePath);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+
+    QDataStream in(&file);
+    in.setVersion(QDataStream::Qt_6_0);
+
+    quint32 magic, version;
+    in >> magic >> version;
+    if (magic != CHECKPOINT_MAGIC || version != CHECKPOINT_VERSION)
+        return false;
+
+    in >> cp.graphLayout >> cp.simulationSpeed;
+    if (!cp.vehicles.load(in) || !cp.paths.load(in))
+        return false;
+
+    qint32 count;
+    in >> count;
+    for (qint32 i = 0; i < count && in.status() == QDataStream::Ok; ++i) {
+        TrafficLight light;
+        in >> light.nodeId >> light.isGreen >> light.timer >> light.cycleDuration;
+        cp.lights.insert(light.nodeId, light);
+    }
+
+    in >> count;
+    for (qint32 i = 0; i < count && in.status() == QDataStream::Ok; ++i) {
+        qint64 nodeId;
+        QList<qint64> queue;
+        in >> nodeId >> queue;
+        cp.queues[nodeId].append(queue);
+    }
+
+    QList<qint64> rerouteQueue;
+    qint32 rerouteBudget;
+    in >> cp.releaseTimers;
+    in >> cp.rerouteInterval >> cp.rerouteTimer >> rerouteBudget >> rerouteQueue;
+    cp.rerouteBudget = rerouteBudget;
+    cp.rerouteQueue.append(rerouteQueue);
+
+    in >> count;
+    for (qint32 i = 0; i < count && in.status() == QDataStream::Ok; ++i) {
+        EdgeKey key;
+        double factor;
+        in >> key.first >> key.second >> factor;
+        cp.congestion.append(qMakePair(key, factor));
+    }
+
+    in >> cp.simulationTime;
+    readDepartures(in, cp.spawnBacklog);
+    in >> cp.hasDemand;
+    if (cp.hasDemand) {
+        QByteArray rngState;
+        in >> rngState >> cp.demand.generatedUntil;
+        std::istringstream rngIn(rngState.toStdString());
+        rngIn >> cp.demand.rng;
+        if (rngIn.fail())
+            return false;
+        readDepartures(in, cp.demand.pending);
+    }
+
+    return in.status() == QDataStream::Ok;
+}
+
+bool TrafficSimulator::restoreCheckpoint(const QString& filePath)
+{
+    Checkpoint cp;
+    if (!readCheckpoint(cp, filePath)) {
+        qWarning() << "Failed to read checkpoint" << filePath;
+        return false;
+    }
+    if (cp.graphLayout != graph->layoutHash()) {
+        qWarning() << "Checkpoint" << filePath << "was taken on a different map";
+        return false;
+    }
+
+    simulationSpeed = cp.simulationSpeed;
+    vehiclePool = cp.vehicles;
+    pathArena = cp.paths;
+    trafficLights = cp.lights;
+    lightQueues = cp.queues;
+    lightReleaseTimers = cp.releaseTimers;
+    rerouteInterval = cp.rerouteInterval;
+    rerouteTimer = cp.rerouteTimer;
+    rerouteBudget = cp.rerouteBudget;
+    rerouteQueue = cp.rerouteQueue;
+    rerouteQueued = QSet<qint64>(rerouteQueue.cbegin(), rerouteQueue.cend());
+
+    simulationTime = cp.simulationTime;
+    pendingTime = 0.0;
+    spawnBacklog = cp.spawnBacklog;
+    if (demand && cp.hasDemand)
+        demand->restore(cp.demand);
+    else if (cp.hasDemand)
+        qWarning() << "Checkpoint" << filePath << "has demand state but no demand model is set";
+
+    graph->resetCongestion();
+    congestedEdges.clear();
+    for (const auto& entry : cp.congestion) {
+        graph->setEdgeCongestion(entry.first.first, entry.first.second, entry.second);
+        congestedEdges.insert(entry.first);
+    }
+
+    return true;
 }
 
 QPointF TrafficSimulator::interpolatePosition(const QPointF& a, const QPointF& b, double t)
@@ -7,24 +7,20 @@
 #include <QPointF>
 #include <QMap>
 #include <QQueue>
+#include <QHash>
+#include <QSet>
+#include <QPair>
 #include <QRandomGenerator>
 #include <QColor>
+#include <QElapsedTimer>
+#include <QDeadlineTimer>
+#include <QFutureWatcher>
 #include "graph.h"
-
-struct Vehicle {
-    qint64 id;
-    QVector<qint64> path;    // sequence of node IDs
-    int currentIndex;         // current edge index in path
-    double progress;          // 0.0 - 1.0 along edge
-    double speed;             // m/s
-    bool waitingAtLight;
-    QColor color;
-    QPointF position;         // screen/map position
-
-    Vehicle()
-        : id(0), currentIndex(0), progress(0.0), speed(0.0),
-        waitingAtLight(false), position(0,0) {}
-};
+#include "simulation_metrics.h"
+#include "vehicle_pool.h"
+#include "path_arena.h"
+#include "graph_partition.h"
+#include "demand_model.h"
 
 struct TrafficLight {
     qint64 nodeId;
@@ -33,28 +29,94 @@ struct TrafficLight {
     double cycleDuration;     // seconds
 };
 
+// A vehicle leaving this simulator's region: the rest of its route, starting
+// with the edge it has just entered, and the state the receiving shard keeps
+struct HandoffVehicle {
+    QVector<qint64> route;
+    double speed;
+    QColor color;
+};
+
 class TrafficSimulator : public QObject
 {
     Q_OBJECT
 public:
     explicit TrafficSimulator(Graph* graph, QObject* parent = nullptr);
 
+    // Interactive runs: a frame timer advances simulated time by measured
+    // wall time in fixed steps, catching up at most `steps` steps per frame.
+    // Re-routing, spawning and metrics writes are sliced into the time left
+    // in each frame; frameOverrun() reports frames that ran long or had to
+    // drop simulated time.
     void start();
     void stop();
-    void addVehicle(qint64 source, qint64 destination);
+    void setMaxCatchUpSteps(int steps);
+    qint64 addVehicle(qint64 source, qint64 destination);  // handle, or 0 if unroutable
+    int addVehicles(const QVector<QPair<qint64, qint64>>& trips);  // number added
+
+    // Spawn the demand's departures as the simulation clock reaches them.
+    // The model is not owned; pass nullptr to stop spawning.
+    void setDemand(DemandModel* demand);
+    double getSimulationTime() const { return simulationTime; }
     void reset();
 
+    // Congestion-aware re-routing: edge weights are refreshed from live
+    // occupancy every interval, and affected vehicles are re-routed at
+    // most `vehiclesPerTick` at a time per frame
+    void setRerouteInterval(double seconds);
+    void setRerouteBudget(int vehiclesPerTick);
+
+    // Instrumentation
+    void setMetricsEnabled(bool enabled);
+    bool isMetricsEnabled() const { return metricsEnabled; }
+    const SimulationMetrics& metrics() const { return simMetrics; }
+    void setMetricsExport(const QString& filePath,
+                          SimulationMetrics::Format format = SimulationMetrics::Prometheus,
+                          int intervalMs = 5000);
+
+    // Checkpoints: a binary snapshot of vehicles, routes, lights and queues.
+    // saveCheckpoint() only takes implicitly shared copies on this thread
+    // (the tick pays for copy-on-write later), plus a copy of the demand
+    // generator, and writes in the background. Saving never changes the run.
+    // A checkpoint can only be restored onto the same loaded map. The demand
+    // model's clock and generator are included, so set the model with
+    // setDemand() before restoring.
+    void saveCheckpoint(const QString& filePath);
+    bool restoreCheckpoint(const QString& filePath);
+    void setAutoCheckpoint(const QString& filePath, int intervalMs);
+
+    // Sharded runs: only vehicles whose current edge starts inside `region`
+    // are simulated here. A vehicle entering an edge owned by another region
+    // is moved to the outbox and must be delivered to that shard's
+    // acceptHandoffs(). The shard driver calls step() instead of start().
+    void setRegion(const GraphPartition* partition, int region);
+    void step(double deltaTime);
+    QVector<HandoffVehicle> takeHandoffs();
+    int acceptHandoffs(const QVector<HandoffVehicle>& vehicles);
+    int liveVehicleCount() const { return vehiclePool.liveCount(); }
+
+public slots:
+    // Call after closing, reopening or reweighting edges (e.g. from
+    // Graph::applyOsmChange) so vehicles routed over them are re-planned
+    void handleEdgesChanged(const QList<Graph::EdgeKey>& edges);
+
 signals:
     void vehiclesUpdated(const QVector<Vehicle>& vehicles);
     void trafficLightsUpdated(const QVector<TrafficLight>& lights);
+    void vehiclesAffected(const QVector<qint64>& vehicleIds);
+    void checkpointSaved(const QString& filePath, bool ok);
+    void frameOverrun(qint64 frameMicros, double droppedSeconds);
 
 private slots:
     void updateSimulation();
+    void exportMetrics();
+    void autoCheckpoint();
 
 private:
     Graph* graph;
     QTimer timer;
-    QVector<Vehicle> vehicles;
+    VehiclePool vehiclePool;
+    PathArena pathArena;
     QMap<qint64, TrafficLight> trafficLights;
 
     // Per-node queues and release timers (used from cpp)
@@ -62,12 +124,95 @@ private:
     QMap<qint64, double> lightReleaseTimers;       // keyed by nodeId
 
     double simulationSpeed;   // simulation time multiplier
-    qint64 nextVehicleId;
+    double simulationTime;    // simulated seconds since start or reset
+    DemandModel* demand;
+    QVector<DemandModel::Departure> spawnBacklog;
+
+    // Frame scheduling
+    QElapsedTimer wallClock;  // since the previous frame
+    double pendingTime;       // simulated seconds owed to the clock
+    int maxCatchUpSteps;
+
+    // Re-routing state
+    typedef Graph::EdgeKey EdgeKey;
+    double rerouteInterval;   // simulated seconds between weight refreshes, <= 0 disables
+    double rerouteTimer;
+    int rerouteBudget;        // max route searches per frame
+    QQueue<qint64> rerouteQueue;                   // vehicle ids
+    QSet<qint64> rerouteQueued;
+    QSet<EdgeKey> congestedEdges;
+
+    // Metrics
+    bool metricsEnabled;
+    SimulationMetrics simMetrics;
+    QElapsedTimer phaseClock;
+    QTimer metricsExportTimer;
+    QString metricsExportPath;
+    SimulationMetrics::Format metricsExportFormat;
+    bool metricsFlushPending;
+    QElapsedTimer metricsFlushWait;
+
+    // Checkpoint state
+    struct Checkpoint {
+        quint64 graphLayout;
+        double simulationSpeed;
+        VehiclePool vehicles;
+        PathArena paths;
+        QMap<qint64, TrafficLight> lights;
+        QMap<qint64, QQueue<qint64>> queues;
+        QMap<qint64, double> releaseTimers;
+        double rerouteInterval;
+        double rerouteTimer;
+        int rerouteBudget;
+        QQueue<qint64> rerouteQueue;
+        QList<QPair<EdgeKey, double>> congestion;
+        double simulationTime;
+        QVector<DemandModel::Departure> spawnBacklog;
+        bool hasDemand;
+        DemandModel::State demand;
+    };
+    QFutureWatcher<bool> checkpointWatcher;
+    QString pendingCheckpointPath;
+    QTimer checkpointTimer;
+    QString autoCheckpointPath;
+
+    // Sharding
+    const GraphPartition* partition;   // null when simulating the whole graph
+    int region;
+    QVector<HandoffVehicle> outbox;
+
+    Checkpoint captureCheckpoint() const;
+    static bool writeCheckpoint(const Checkpoint& cp, const QString& filePath);
+    static bool readCheckpoint(Checkpoint& cp, const QString& filePath);
 
     void updateQueues(double deltaTime);
     void updateVehicles(double deltaTime);
     void updateTrafficLights(double deltaTime);
+    void simulateStep(double deltaTime, qint64 budgetNanos);
+    void runDeferredWork(const QDeadlineTimer& deadline);
+    void emitState();
+    void updateEdgeWeights(double deltaTime);
+    void drainReroutes(const QDeadlineTimer& deadline);
+    void spawnDepartures(const QDeadlineTimer& deadline);
+    void flushMetrics();
+    void refreshEdgeWeights();
+    bool rerouteVehicle(Vehicle& v);
+    double remainingCost(const Vehicle& v) const;
+    void queueReroute(qint64 vehicleId);
+    bool assignPath(Vehicle& v, const QVector<qint64>& nodeIds);
+    qint64 spawnVehicle(const QVector<qint64>& path);
+    bool acceptsTrip(qint64 source, qint64 destination);
+    void advanceEdge(Vehicle& v);
+    void retireVehicles(const QVector<qint64>& handles);
+    void handOffVehicles(const QVector<qint64>& handles);
+    void releaseVehicle(Vehicle& v);
+    bool ownsNode(qint64 nodeId) const;
+    void compactPaths();
+    template <typename Visit>
+    void forEachRemainingEdge(const Vehicle& v, Visit visit) const;
     QPointF interpolatePosition(const QPointF& a, const QPointF& b, double t);
+    void lapPhase(SimulationMetrics::Phase phase, qint64& lapStart);
+    void updateVehicleCounters();
 };
 
 #endif // TRAFFIC_SIMULATOR_H
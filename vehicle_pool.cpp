@@ -0,0 +1,111 @@
+#include "vehicle_pool.h"
+#include <QDataStream>
+
+Vehicle& VehiclePool::acquire()
+{
+    int slot;
+    if (!freeSlots.isEmpty()) {
+        slot = freeSlots.takeLast();
+    } else {
+        slot = items.size();
+        items.append(Vehicle());
+        generations.append(1);
+    }
+
+    Vehicle& v = items[slot];
+    v = Vehicle();
+    v.id = (qint64(generations[slot]) << 32) | slot;
+    v.active = true;
+    live++;
+    return v;
+}
+
+void VehiclePool::release(qint64 handle)
+{
+    Vehicle* v = get(handle);
+    if (!v) {
+        return;
+    }
+
+    int slot = slotOf(handle);
+    v->active = false;
+    generations[slot]++;
+    freeSlots.append(slot);
+    live--;
+}
+
+Vehicle* VehiclePool::get(qint64 handle)
+{
+    int slot = slotOf(handle);
+    if (slot >= items.size() || generations[slot] != generationOf(handle) || !items[slot].active) {
+        return nullptr;
+    }
+    return &items[slot];
+}
+
+const Vehicle* VehiclePool::get(qint64 handle) const
+{
+    int slot = slotOf(handle);
+    if (slot >= items.size() || generations[slot] != generationOf(handle) || !items[slot].active) {
+        return nullptr;
+    }
+    return &items[slot];
+}
+
+void VehiclePool::clear()
+{
+    items.clear();
+    generations.clear();
+    freeSlots.clear();
+    live = 0;
+}
+
+void VehiclePool::save(QDataStream& out) const
+{
+    out << qint32(items.size()) << generations << freeSlots;
+
+    for (const Vehicle& v : items) {
+        out << v.active;
+        if (!v.active) {
+            continue;
+        }
+        out << v.id << v.path.offset << v.path.length << qint32(v.currentIndex)
+            << v.fromNode << v.toNode << v.toIndex << v.destination
+            << v.progress << v.speed << v.waitingAtLight << v.color << v.position;
+    }
+}
+
+bool VehiclePool::load(QDataStream& in)
+{
+    qint32 count;
+    QVector<quint32> loadedGenerations;
+    QVector<int> loadedFree;
+    in >> count >> loadedGenerations >> loadedFree;
+    if (in.status() != QDataStream::Ok || count < 0 || loadedGenerations.size() != count) {
+        return false;
+    }
+
+    QVector<Vehicle> loaded(count);
+    int loadedLive = 0;
+    for (Vehicle& v : loaded) {
+        in >> v.active;
+        if (!v.active) {
+            continue;
+        }
+        qint32 currentIndex;
+        in >> v.id >> v.path.offset >> v.path.length >> currentIndex
+            >> v.fromNode >> v.toNode >> v.toIndex >> v.destination
+            >> v.progress >> v.speed >> v.waitingAtLight >> v.color >> v.position;
+        v.currentIndex = currentIndex;
+        loadedLive++;
+    }
+    if (in.status() != QDataStream::Ok) {
+        return false;
+    }
+
+    items = loaded;
+    generations = loadedGenerations;
+    freeSlots = loadedFree;
+    live = loadedLive;
+    return true;
+}
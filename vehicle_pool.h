@@ -0,0 +1,69 @@
+#ifndef VEHICLE_POOL_H
+#define VEHICLE_POOL_H
+
+#include <QtGlobal>
+#include <QVector>
+#include <QPointF>
+#include <QColor>
+#include "path_arena.h"
+
+class QDataStream;
+
+struct Vehicle {
+    qint64 id;                // pool handle, stable while the vehicle is alive
+    bool active;              // false for free pool slots
+    PathArena::Ref path;      // route in the simulator's PathArena
+    int currentIndex;         // current edge index in path
+    qint64 fromNode;          // current edge endpoints (node IDs)
+    qint64 toNode;
+    qint32 toIndex;           // dense index of toNode, used to walk the path
+    qint64 destination;
+    double progress;          // 0.0 - 1.0 along edge
+    double speed;             // m/s
+    bool waitingAtLight;
+    QColor color;
+    QPointF position;         // screen/map position
+
+    Vehicle()
+        : id(0), active(false), currentIndex(0), fromNode(0), toNode(0), toIndex(0),
+        destination(0), progress(0.0), speed(0.0), waitingAtLight(false), position(0,0) {}
+
+    bool hasArrived() const { return currentIndex >= int(path.length) - 1; }
+};
+
+// Fixed slots for vehicles with a free list. A handle packs the slot
+// index (low 32 bits) with a per-slot generation (high 32 bits), so a
+// handle to a retired vehicle never resolves to the slot's next occupant.
+class VehiclePool
+{
+public:
+    VehiclePool() : live(0) {}
+
+    Vehicle& acquire();            // active vehicle with its id set
+    void release(qint64 handle);
+    Vehicle* get(qint64 handle);   // nullptr if the handle is stale
+    const Vehicle* get(qint64 handle) const;
+
+    // All slots, including inactive ones (check Vehicle::active)
+    QVector<Vehicle>& all() { return items; }
+    const QVector<Vehicle>& all() const { return items; }
+
+    int liveCount() const { return live; }
+    void clear();
+
+    // Checkpointing; slots, generations and free list are kept as-is so
+    // handles stay valid across a restore
+    void save(QDataStream& out) const;
+    bool load(QDataStream& in);
+
+private:
+    static int slotOf(qint64 handle) { return int(handle & 0xffffffff); }
+    static quint32 generationOf(qint64 handle) { return quint32(quint64(handle) >> 32); }
+
+    QVector<Vehicle> items;
+    QVector<quint32> generations;
+    QVector<int> freeSlots;
+    int live;
+};
+
+#endif // VEHICLE_POOL_H